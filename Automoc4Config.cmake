@@ -13,6 +13,49 @@
 # AUTOMOC4_ADD_LIBRARY(<target_NAME> src1 src2 ...)
 #    This macro does the same as ADD_LIBRARY, but additionally
 #    adds automoc4 handling for all source files.
+#
+# The following variables can be set to change the behaviour of the macros:
+#  AUTOMOC4_QUIET
+#    If enabled, automoc4 prints only one line per target instead of a line
+#    for every generated moc file.
+#  AUTOMOC4_BATCH
+#    If enabled, the automoc targets created by AUTOMOC4_ADD_EXECUTABLE,
+#    AUTOMOC4_ADD_LIBRARY and the KDE4 macros of one directory are all processed
+#    by a single automoc4 process, which shares the scan results of the headers
+#    between the targets. Since CMake 3.20 the process only runs when a file it
+#    looked at changed.
+#  AUTOMOC4_SHARDS
+#    If set to a number greater than 1, the mocs which are not included by a
+#    source file are spread over that many generated source files instead of
+#    one, balanced by the size of the mocs, so they are compiled in parallel
+#    and a changed moc only recompiles its own part.
+#  AUTOMOC4_SERVER
+#    Path of a local socket. If an "automoc4 --server <socket>" process is
+#    listening there, the automoc targets let it do the work, which saves
+#    rescanning unchanged files. Without a server the targets work as usual.
+#  AUTOMOC4_MOC_CACHE
+#    Path of a directory where automoc4 keeps the output of moc, keyed by the
+#    moc executable, its arguments and the contents of the input. Build
+#    directories using the same cache directory copy the mocs from there
+#    instead of running moc again. The size of the cache is limited by the
+#    AUTOMOC4_MOC_CACHE_SIZE environment variable, in MiB, 512 by default.
+#    The AUTOMOC4_MOC_CACHE environment variable enables the cache as well.
+#  AUTOMOC4_IN_PROCESS_MOC
+#    If enabled and automoc4 was built with AUTOMOC4_MOC_SOURCE_DIR, the moc
+#    engine built into automoc4 is used instead of starting the moc executable
+#    for every header. The engine must come from the same Qt version as the
+#    moc executable.
+#  AUTOMOC4_USE_PCH
+#    If enabled, automoc4 writes the Qt includes of the mocs in the
+#    _automoc.cpp files of the targets created by AUTOMOC4_ADD_EXECUTABLE,
+#    AUTOMOC4_ADD_LIBRARY and the KDE4 macros and of the headers these mocs
+#    are generated from, and the headers included by more than one of those
+#    mocs, to a prefix header, which is compiled as precompiled header for
+#    those files. The other sources of the targets get
+#    SKIP_PRECOMPILE_HEADERS, so don't combine it with
+#    target_precompile_headers() on the same targets. Needs CMake 3.16 and is
+#    ignored with AUTOMOC4_BATCH. Targets using the AUTOMOC4() macro directly
+#    don't get a prefix header.
 
 # Internal helper macro, may change or be removed anytime:
 # _ADD_AUTOMOC4_TARGET(<target_NAME> <SRCS_VAR>)
@@ -86,6 +129,122 @@ else(EXISTS ${_AUTOMOC4_CURRENT_DIR}/kde4automoc.cpp)
 endif(EXISTS ${_AUTOMOC4_CURRENT_DIR}/kde4automoc.cpp)
 
 
+# Internal helper macro, sets _automoc4_options to the options from the AUTOMOC4_* variables
+macro(_AUTOMOC4_OPTIONS)
+   set(_automoc4_options)
+   if(AUTOMOC4_QUIET)
+      list(APPEND _automoc4_options --quiet)
+   endif(AUTOMOC4_QUIET)
+   if(AUTOMOC4_SERVER)
+      list(APPEND _automoc4_options --client "${AUTOMOC4_SERVER}")
+   endif(AUTOMOC4_SERVER)
+   if(AUTOMOC4_SHARDS GREATER 1)
+      list(APPEND _automoc4_options --shards ${AUTOMOC4_SHARDS})
+   endif(AUTOMOC4_SHARDS GREATER 1)
+   if(AUTOMOC4_MOC_CACHE)
+      list(APPEND _automoc4_options --moc-cache "${AUTOMOC4_MOC_CACHE}")
+   endif(AUTOMOC4_MOC_CACHE)
+   if(AUTOMOC4_IN_PROCESS_MOC)
+      list(APPEND _automoc4_options --in-process-moc)
+   endif(AUTOMOC4_IN_PROCESS_MOC)
+endmacro(_AUTOMOC4_OPTIONS)
+
+# Internal helper macro, sets _automoc4_shards to the generated source files besides
+# <automoc_source> when AUTOMOC4_SHARDS is used, named like automoc4 names them
+macro(_AUTOMOC4_SHARDS _automoc_source)
+   set(_automoc4_shards)
+   if(AUTOMOC4_SHARDS GREATER 1)
+      string(REGEX REPLACE "\\.cpp$" "" _automoc4_shard_base "${_automoc_source}")
+      math(EXPR _automoc4_last_shard "${AUTOMOC4_SHARDS} - 1")
+      foreach(_automoc4_shard RANGE 1 ${_automoc4_last_shard})
+         list(APPEND _automoc4_shards "${_automoc4_shard_base}_${_automoc4_shard}.cpp")
+      endforeach(_automoc4_shard)
+   endif(AUTOMOC4_SHARDS GREATER 1)
+endmacro(_AUTOMOC4_SHARDS)
+
+# Internal helper macro, writes the <outfile>.files manifest automoc4 reads for a target from
+# _moc_files, _moc_incs, _moc_cdefs and _moc_defs. It starts with an index of the sections and
+# a fingerprint of what the moc arguments are made of, so automoc4 only reads what it needs.
+# string(MD5) needs CMake 2.8.7, older versions write the line based format.
+macro(_AUTOMOC4_WRITE_MANIFEST _manifest)
+   if(CMAKE_VERSION VERSION_LESS 2.8.7)
+      # configure_file replaces _moc_files, _moc_incs, _moc_cdefs and _moc_defs
+      configure_file(${_AUTOMOC4_CURRENT_DIR}/automoc4.files.in ${_manifest})
+   else(CMAKE_VERSION VERSION_LESS 2.8.7)
+      set(_automoc4_project_before "${CMAKE_INCLUDE_DIRECTORIES_PROJECT_BEFORE}")
+      string(MD5 _automoc4_fingerprint "${_moc_cdefs}\n${_moc_defs}\n${_moc_incs}\n${_automoc4_project_before}\n${CMAKE_BINARY_DIR}\n${CMAKE_SOURCE_DIR}")
+      set(_automoc4_index "automoc4 manifest 1\nfingerprint ${_automoc4_fingerprint}\n")
+      set(_automoc4_sections)
+      set(_automoc4_offset 0)
+      # the offsets are relative to the end of the index, string(LENGTH) counts bytes
+      foreach(_automoc4_section sources:_moc_files compile_definitions:_moc_cdefs
+            definitions:_moc_defs includes:_moc_incs project_before:_automoc4_project_before
+            binary_dir:CMAKE_BINARY_DIR source_dir:CMAKE_SOURCE_DIR)
+         string(REGEX REPLACE ":.*$" "" _automoc4_section_name "${_automoc4_section}")
+         string(REGEX REPLACE "^.*:" "" _automoc4_section_var "${_automoc4_section}")
+         string(LENGTH "${${_automoc4_section_var}}" _automoc4_length)
+         set(_automoc4_index "${_automoc4_index}${_automoc4_section_name} ${_automoc4_offset} ${_automoc4_length}\n")
+         set(_automoc4_sections "${_automoc4_sections}${${_automoc4_section_var}}\n")
+         math(EXPR _automoc4_offset "${_automoc4_offset} + ${_automoc4_length} + 1")
+      endforeach(_automoc4_section)
+      set(_automoc4_manifest "${_automoc4_index}end\n${_automoc4_sections}")
+
+      # only written when it changed, automoc4 is rerun when it is newer than its outputs
+      set(_automoc4_old_manifest)
+      if(EXISTS ${_manifest})
+         file(READ ${_manifest} _automoc4_old_manifest)
+      endif(EXISTS ${_manifest})
+      if(NOT "${_automoc4_old_manifest}" STREQUAL "${_automoc4_manifest}")
+         file(WRITE ${_manifest} "${_automoc4_manifest}")
+      endif(NOT "${_automoc4_old_manifest}" STREQUAL "${_automoc4_manifest}")
+   endif(CMAKE_VERSION VERSION_LESS 2.8.7)
+endmacro(_AUTOMOC4_WRITE_MANIFEST)
+
+# Internal helper macro, sets _automoc4_pch to the prefix header automoc4 writes for
+# <automoc_source> when AUTOMOC4_USE_PCH is used, and to nothing otherwise
+macro(_AUTOMOC4_PCH _automoc_source)
+   set(_automoc4_pch)
+   if(AUTOMOC4_USE_PCH AND NOT AUTOMOC4_BATCH AND NOT CMAKE_VERSION VERSION_LESS 3.16)
+      string(REGEX REPLACE "\\.cpp$" "" _automoc4_pch "${_automoc_source}")
+      set(_automoc4_pch "${_automoc4_pch}_pch.h")
+   endif(AUTOMOC4_USE_PCH AND NOT AUTOMOC4_BATCH AND NOT CMAKE_VERSION VERSION_LESS 3.16)
+endmacro(_AUTOMOC4_PCH)
+
+# Internal helper macro, compiles the prefix header of <target>_automoc as precompiled header of
+# the _automoc.cpp files of <target>, the other sources of <target> don't use it
+macro(_AUTOMOC4_PRECOMPILE _target)
+   set(_automoc4_automoc_source "${CMAKE_CURRENT_BINARY_DIR}/${_target}_automoc.cpp")
+   _automoc4_pch(${_automoc4_automoc_source})
+   if(_automoc4_pch AND TARGET "${_target}_automoc")
+      _automoc4_shards(${_automoc4_automoc_source})
+      set(_automoc4_automoc_sources ${_automoc4_automoc_source} ${_automoc4_shards})
+      get_target_property(_automoc4_target_sources ${_target} SOURCES)
+      foreach(_automoc4_source ${_automoc4_target_sources})
+         get_filename_component(_automoc4_abs_source "${_automoc4_source}" ABSOLUTE)
+         list(FIND _automoc4_automoc_sources "${_automoc4_abs_source}" _automoc4_index)
+         if(_automoc4_index EQUAL -1)
+            set_source_files_properties(${_automoc4_source} PROPERTIES SKIP_PRECOMPILE_HEADERS ON)
+         endif(_automoc4_index EQUAL -1)
+      endforeach(_automoc4_source)
+      target_precompile_headers(${_target} PRIVATE "${_automoc4_pch}")
+   endif(_automoc4_pch AND TARGET "${_target}_automoc")
+endmacro(_AUTOMOC4_PRECOMPILE)
+
+# automoc4 writes a depfile with everything it looked at, so the build tool only starts it when
+# one of those files changed. Only since CMake 3.20 DEPFILE works with all generators.
+set(_AUTOMOC4_USE_DEPFILE FALSE)
+if(NOT CMAKE_VERSION VERSION_LESS 3.20)
+   set(_AUTOMOC4_USE_DEPFILE TRUE)
+endif(NOT CMAKE_VERSION VERSION_LESS 3.20)
+
+# the mocs started by automoc4 take tokens from the jobserver of make. make only passes its
+# jobserver to commands it considers recursive, since CMake 3.28 they can be marked as such.
+set(_automoc4_job_server)
+if(NOT CMAKE_VERSION VERSION_LESS 3.28)
+   set(_automoc4_job_server JOB_SERVER_AWARE TRUE)
+endif(NOT CMAKE_VERSION VERSION_LESS 3.28)
+
+
 macro (AUTOMOC4_MOC_HEADERS _target_NAME)
    set (_headers_to_moc)
    foreach (_current_FILE ${ARGN})
@@ -137,26 +296,79 @@ macro(AUTOMOC4 _target_NAME _SRCS)
       # Assume CMAKE_INCLUDE_CURRENT_DIR is set
       list(APPEND _moc_incs ${CMAKE_CURRENT_SOURCE_DIR} ${CMAKE_CURRENT_BINARY_DIR})
 
-      # configure_file replaces _moc_files, _moc_incs, _moc_cdefs and _moc_defs
-      configure_file(${_AUTOMOC4_CURRENT_DIR}/automoc4.files.in ${_automoc_source}.files)
-
-      add_custom_command(OUTPUT ${_automoc_source}
-         COMMAND ${AUTOMOC4_EXECUTABLE}
-         ${_automoc_source}
-         ${CMAKE_CURRENT_SOURCE_DIR}
-         ${CMAKE_CURRENT_BINARY_DIR}
-         ${QT_MOC_EXECUTABLE}
-         ${CMAKE_COMMAND}
-         --touch
-         DEPENDS ${_automoc_source}.files ${_AUTOMOC4_EXECUTABLE_DEP}
-         COMMENT ""
-         VERBATIM
-         )
-      set(${_SRCS} ${_automoc_source} ${${_SRCS}})
+      _automoc4_write_manifest(${_automoc_source}.files)
+
+      _automoc4_options()
+      _automoc4_shards(${_automoc_source})
+      if(_AUTOMOC4_USE_DEPFILE)
+         # the stamp file is the output, the _automoc.cpp files are only rewritten when their
+         # contents change and don't have to be touched to be newer than the depfile entries
+         add_custom_command(OUTPUT ${_automoc_source}.stamp
+            BYPRODUCTS ${_automoc_source} ${_automoc4_shards}
+            COMMAND ${AUTOMOC4_EXECUTABLE}
+            ${_automoc_source}
+            ${CMAKE_CURRENT_SOURCE_DIR}
+            ${CMAKE_CURRENT_BINARY_DIR}
+            ${QT_MOC_EXECUTABLE}
+            ${CMAKE_COMMAND}
+            --depfile ${_automoc_source}.d
+            --stamp ${_automoc_source}.stamp
+            ${_automoc4_options}
+            DEPENDS ${_automoc_source}.files ${_AUTOMOC4_EXECUTABLE_DEP}
+            DEPFILE ${_automoc_source}.d
+            COMMENT ""
+            VERBATIM
+            ${_automoc4_job_server}
+            )
+         set_source_files_properties(${_automoc_source} ${_automoc4_shards} PROPERTIES GENERATED TRUE)
+         # the target depends on the stamp, so the command runs before its sources are compiled
+         set(${_SRCS} ${_automoc_source}.stamp ${${_SRCS}})
+      else(_AUTOMOC4_USE_DEPFILE)
+         add_custom_command(OUTPUT ${_automoc_source} ${_automoc4_shards}
+            COMMAND ${AUTOMOC4_EXECUTABLE}
+            ${_automoc_source}
+            ${CMAKE_CURRENT_SOURCE_DIR}
+            ${CMAKE_CURRENT_BINARY_DIR}
+            ${QT_MOC_EXECUTABLE}
+            ${CMAKE_COMMAND}
+            --touch
+            ${_automoc4_options}
+            DEPENDS ${_automoc_source}.files ${_AUTOMOC4_EXECUTABLE_DEP}
+            COMMENT ""
+            VERBATIM
+            ${_automoc4_job_server}
+            )
+      endif(_AUTOMOC4_USE_DEPFILE)
+      set(${_SRCS} ${_automoc_source} ${_automoc4_shards} ${${_SRCS}})
    endif(_moc_files)
 endmacro(AUTOMOC4)
 
 
+# Internal helper function, called at the end of a directory using AUTOMOC4_BATCH with
+# _AUTOMOC4_USE_DEPFILE: adds the command running automoc4 once for all targets of the
+# directory, with one depfile and one stamp file for the whole batch
+function(_AUTOMOC4_ADD_BATCH_COMMAND)
+   set(_automoc4_batch_list "${CMAKE_CURRENT_BINARY_DIR}/automoc4_batch.list")
+   get_directory_property(_automoc4_options AUTOMOC4_BATCH_OPTIONS)
+   get_directory_property(_automoc4_manifests AUTOMOC4_BATCH_MANIFESTS)
+   get_directory_property(_automoc4_outputs AUTOMOC4_BATCH_OUTPUTS)
+   add_custom_command(OUTPUT ${_automoc4_batch_list}.stamp
+      BYPRODUCTS ${_automoc4_outputs}
+      COMMAND ${AUTOMOC4_EXECUTABLE}
+      --batch ${_automoc4_batch_list}
+      ${QT_MOC_EXECUTABLE}
+      ${CMAKE_COMMAND}
+      --depfile ${_automoc4_batch_list}.d
+      --stamp ${_automoc4_batch_list}.stamp
+      ${_automoc4_options}
+      DEPENDS ${_automoc4_manifests} ${_AUTOMOC4_EXECUTABLE_DEP}
+      DEPFILE ${_automoc4_batch_list}.d
+      COMMENT ""
+      VERBATIM
+      ${_automoc4_job_server}
+      )
+endfunction(_AUTOMOC4_ADD_BATCH_COMMAND)
+
 macro(_ADD_AUTOMOC4_TARGET _target_NAME _SRCS)
    set(_moc_files)
    set(_moc_headers)
@@ -202,29 +414,106 @@ macro(_ADD_AUTOMOC4_TARGET _target_NAME _SRCS)
       # Assume CMAKE_INCLUDE_CURRENT_DIR is set
       list(APPEND _moc_incs ${CMAKE_CURRENT_SOURCE_DIR} ${CMAKE_CURRENT_BINARY_DIR})
 
-      # configure_file replaces _moc_files, _moc_incs, _moc_cdefs and _moc_defs
-      configure_file(${_AUTOMOC4_CURRENT_DIR}/automoc4.files.in ${_automoc_dotFiles})
-
-      add_custom_target(${_target_NAME}
-         COMMAND ${AUTOMOC4_EXECUTABLE}
-         ${_automoc_source}
-         ${CMAKE_CURRENT_SOURCE_DIR}
-         ${CMAKE_CURRENT_BINARY_DIR}
-         ${QT_MOC_EXECUTABLE}
-         ${CMAKE_COMMAND}
-         COMMENT ""
-         VERBATIM
-         )
-
-      if(_AUTOMOC4_EXECUTABLE_DEP)
-         add_dependencies(${_target_NAME} ${_AUTOMOC4_EXECUTABLE_DEP})
-      endif(_AUTOMOC4_EXECUTABLE_DEP)
-
-      set_source_files_properties(${_automoc_source} PROPERTIES GENERATED TRUE)
+      _automoc4_write_manifest(${_automoc_dotFiles})
+
+      _automoc4_options()
+      _automoc4_shards(${_automoc_source})
+      _automoc4_pch(${_automoc_source})
+      set(_automoc4_pch_byproducts)
+      if(_automoc4_pch)
+         list(APPEND _automoc4_options --pch)
+         set(_automoc4_pch_byproducts BYPRODUCTS ${_automoc4_pch})
+      endif(_automoc4_pch)
+      if(AUTOMOC4_BATCH)
+         # one automoc4 process per directory handles all automoc targets of the directory,
+         # the first target creates it and every target adds itself to its list file
+         get_directory_property(_automoc4_batch_target AUTOMOC4_BATCH_TARGET)
+         set(_automoc4_batch_list "${CMAKE_CURRENT_BINARY_DIR}/automoc4_batch.list")
+         if(NOT _automoc4_batch_target)
+            set(_automoc4_batch_target "${_target_NAME}_batch")
+            set_directory_properties(PROPERTIES AUTOMOC4_BATCH_TARGET ${_automoc4_batch_target})
+            file(WRITE ${_automoc4_batch_list} "")
+            if(_AUTOMOC4_USE_DEPFILE)
+               # the command depends on the manifests of all targets of the directory and has
+               # their sources as byproducts, so it is added once all of them are known
+               set_directory_properties(PROPERTIES AUTOMOC4_BATCH_OPTIONS "${_automoc4_options}")
+               cmake_language(DEFER CALL _automoc4_add_batch_command)
+               set_property(DIRECTORY APPEND PROPERTY ADDITIONAL_MAKE_CLEAN_FILES
+                  "${_automoc4_batch_list}.d" "${_automoc4_batch_list}.stamp")
+               add_custom_target(${_automoc4_batch_target} DEPENDS ${_automoc4_batch_list}.stamp)
+            else(_AUTOMOC4_USE_DEPFILE)
+               add_custom_target(${_automoc4_batch_target}
+                  COMMAND ${AUTOMOC4_EXECUTABLE}
+                  --batch ${_automoc4_batch_list}
+                  ${QT_MOC_EXECUTABLE}
+                  ${CMAKE_COMMAND}
+                  ${_automoc4_options}
+                  COMMENT ""
+                  VERBATIM
+                  ${_automoc4_job_server}
+                  )
+            endif(_AUTOMOC4_USE_DEPFILE)
+            if(_AUTOMOC4_EXECUTABLE_DEP)
+               add_dependencies(${_automoc4_batch_target} ${_AUTOMOC4_EXECUTABLE_DEP})
+            endif(_AUTOMOC4_EXECUTABLE_DEP)
+         endif(NOT _automoc4_batch_target)
+         file(APPEND ${_automoc4_batch_list} "${_automoc_source};${CMAKE_CURRENT_SOURCE_DIR};${CMAKE_CURRENT_BINARY_DIR}\n")
+         set_property(DIRECTORY APPEND PROPERTY AUTOMOC4_BATCH_MANIFESTS ${_automoc_dotFiles})
+         set_property(DIRECTORY APPEND PROPERTY AUTOMOC4_BATCH_OUTPUTS ${_automoc_source} ${_automoc4_shards})
+
+         add_custom_target(${_target_NAME})
+         add_dependencies(${_target_NAME} ${_automoc4_batch_target})
+      elseif(_AUTOMOC4_USE_DEPFILE)
+         # the stamp file is the output, the _automoc.cpp file is only rewritten when its
+         # contents change
+         add_custom_command(OUTPUT ${_automoc_source}.stamp
+            BYPRODUCTS ${_automoc_source} ${_automoc4_shards} ${_automoc4_pch}
+            COMMAND ${AUTOMOC4_EXECUTABLE}
+            ${_automoc_source}
+            ${CMAKE_CURRENT_SOURCE_DIR}
+            ${CMAKE_CURRENT_BINARY_DIR}
+            ${QT_MOC_EXECUTABLE}
+            ${CMAKE_COMMAND}
+            --depfile ${_automoc_source}.d
+            --stamp ${_automoc_source}.stamp
+            ${_automoc4_options}
+            DEPENDS ${_automoc_dotFiles} ${_AUTOMOC4_EXECUTABLE_DEP}
+            DEPFILE ${_automoc_source}.d
+            COMMENT ""
+            VERBATIM
+            ${_automoc4_job_server}
+            )
+         add_custom_target(${_target_NAME} DEPENDS ${_automoc_source}.stamp)
+
+         if(_AUTOMOC4_EXECUTABLE_DEP)
+            add_dependencies(${_target_NAME} ${_AUTOMOC4_EXECUTABLE_DEP})
+         endif(_AUTOMOC4_EXECUTABLE_DEP)
+      else(AUTOMOC4_BATCH)
+         add_custom_target(${_target_NAME}
+            COMMAND ${AUTOMOC4_EXECUTABLE}
+            ${_automoc_source}
+            ${CMAKE_CURRENT_SOURCE_DIR}
+            ${CMAKE_CURRENT_BINARY_DIR}
+            ${QT_MOC_EXECUTABLE}
+            ${CMAKE_COMMAND}
+            ${_automoc4_options}
+            ${_automoc4_pch_byproducts}
+            COMMENT ""
+            VERBATIM
+            ${_automoc4_job_server}
+            )
+
+         if(_AUTOMOC4_EXECUTABLE_DEP)
+            add_dependencies(${_target_NAME} ${_AUTOMOC4_EXECUTABLE_DEP})
+         endif(_AUTOMOC4_EXECUTABLE_DEP)
+      endif(AUTOMOC4_BATCH)
+
+      set_source_files_properties(${_automoc_source} ${_automoc4_shards} ${_automoc4_pch} PROPERTIES GENERATED TRUE)
       get_directory_property(_extra_clean_files ADDITIONAL_MAKE_CLEAN_FILES)
-      list(APPEND _extra_clean_files "${_automoc_source}")
+      list(APPEND _extra_clean_files "${_automoc_source}" "${_automoc_source}.cache"
+         "${_automoc_source}.d" "${_automoc_source}.stamp" ${_automoc4_shards} ${_automoc4_pch})
       set_directory_properties(PROPERTIES ADDITIONAL_MAKE_CLEAN_FILES "${_extra_clean_files}")
-      set(${_SRCS} ${_automoc_source} ${${_SRCS}})
+      set(${_SRCS} ${_automoc_source} ${_automoc4_shards} ${${_SRCS}})
    endif(_moc_files)
 endmacro(_ADD_AUTOMOC4_TARGET)
 
@@ -244,6 +533,7 @@ macro(AUTOMOC4_ADD_EXECUTABLE _target_NAME)
    _add_automoc4_target("${_target_NAME}_automoc" _SRCS)
    add_executable(${_target_NAME} ${_add_executable_param} ${_SRCS})
    add_dependencies(${_target_NAME} "${_target_NAME}_automoc")
+   _automoc4_precompile(${_target_NAME})
 
 endmacro(AUTOMOC4_ADD_EXECUTABLE)
 
@@ -263,6 +553,7 @@ macro(AUTOMOC4_ADD_LIBRARY _target_NAME)
    _add_automoc4_target("${_target_NAME}_automoc" _SRCS)
    add_library(${_target_NAME} ${_add_executable_param} ${_SRCS})
    add_dependencies(${_target_NAME} "${_target_NAME}_automoc")
+   _automoc4_precompile(${_target_NAME})
 endmacro(AUTOMOC4_ADD_LIBRARY)
 
 
@@ -274,6 +565,7 @@ endmacro(_AUTOMOC4_KDE4_PRE_TARGET_HANDLING)
 macro(_AUTOMOC4_KDE4_POST_TARGET_HANDLING _target)
   if (TARGET "${_target}_automoc")
     add_dependencies(${_target} "${_target}_automoc")
+    _automoc4_precompile(${_target})
   endif()
 endmacro(_AUTOMOC4_KDE4_POST_TARGET_HANDLING)
 
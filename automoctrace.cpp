@@ -0,0 +1,129 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "automoctrace.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+static QByteArray jsonString(const QString &s)
+{
+    QByteArray result = "\"";
+    const QByteArray utf8 = s.toUtf8();
+    for (int i = 0; i < utf8.size(); ++i) {
+        const char c = utf8[i];
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            result += "\\u00" + QByteArray::number(c, 16).rightJustified(2, '0');
+        } else {
+            result += c;
+        }
+    }
+    return result + '"';
+}
+
+AutoMocTrace::AutoMocTrace()
+    : enabled(false), pid(QCoreApplication::applicationPid())
+{
+}
+
+qint64 AutoMocTrace::now()
+{
+#ifdef Q_OS_WIN
+    FILETIME fileTime;
+    GetSystemTimeAsFileTime(&fileTime);
+    // 100ns intervals since 1601
+    const quint64 time = (quint64(fileTime.dwHighDateTime) << 32) | fileTime.dwLowDateTime;
+    return (time - Q_UINT64_C(116444736000000000)) / 10;
+#else
+    struct timeval time;
+    gettimeofday(&time, 0);
+    return qint64(time.tv_sec) * 1000000 + time.tv_usec;
+#endif
+}
+
+void AutoMocTrace::complete(const QString &name, const char *category, qint64 start, qint64 end,
+        int thread, const QByteArray &args)
+{
+    if (!enabled) {
+        return;
+    }
+    if (!events.isEmpty()) {
+        events += ",\n";
+    }
+    events += "{\"name\":" + jsonString(name) + ",\"cat\":\"" + category +
+        "\",\"ph\":\"X\",\"ts\":" + QByteArray::number(start) +
+        ",\"dur\":" + QByteArray::number(end - start) +
+        ",\"pid\":" + QByteArray::number(pid) + ",\"tid\":" + QByteArray::number(thread);
+    if (!args.isEmpty()) {
+        // every arg() ends with a comma
+        events += ",\"args\":{" + args.left(args.size() - 1) + '}';
+    }
+    events += '}';
+}
+
+void AutoMocTrace::threadName(int thread, const QString &name)
+{
+    if (!enabled) {
+        return;
+    }
+    if (!events.isEmpty()) {
+        events += ",\n";
+    }
+    events += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + QByteArray::number(pid) +
+        ",\"tid\":" + QByteArray::number(thread) + ",\"args\":{\"name\":" + jsonString(name) + "}}";
+}
+
+QByteArray AutoMocTrace::arg(const char *name, qint64 value)
+{
+    return '"' + QByteArray(name) + "\":" + QByteArray::number(value) + ',';
+}
+
+QByteArray AutoMocTrace::arg(const char *name, const QString &value)
+{
+    return '"' + QByteArray(name) + "\":" + jsonString(value) + ',';
+}
+
+bool AutoMocTrace::write(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    const QByteArray processName = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" +
+        QByteArray::number(pid) + ",\"args\":{\"name\":\"automoc4\"}}";
+    const QByteArray contents = "{\"traceEvents\":[\n" + processName +
+        (events.isEmpty() ? "" : ",\n") + events + "\n],\"displayTimeUnit\":\"ms\"}\n";
+    events.clear();
+    return file.write(contents) == contents.size();
+}
@@ -0,0 +1,63 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef AUTOMOCTRACE_H
+#define AUTOMOCTRACE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+// Collects events in the Chrome trace event format (chrome://tracing, Perfetto). The timestamps
+// are microseconds since the epoch and every event carries the process id, so the traces of all
+// automoc4 processes of a build can be merged into one by concatenating their traceEvents.
+class AutoMocTrace
+{
+    public:
+        AutoMocTrace();
+
+        // microseconds since the epoch
+        static qint64 now();
+
+        void setEnabled(bool on) { enabled = on; }
+        bool isEnabled() const { return enabled; }
+
+        // a complete event from start to end on the given thread lane, args is a list of arg()s
+        void complete(const QString &name, const char *category, qint64 start, qint64 end,
+                int thread = 0, const QByteArray &args = QByteArray());
+        void threadName(int thread, const QString &name);
+
+        static QByteArray arg(const char *name, qint64 value);
+        static QByteArray arg(const char *name, const QString &value);
+
+        // writes all events collected so far and forgets them
+        bool write(const QString &fileName);
+
+    private:
+        bool enabled;
+        qint64 pid;
+        QByteArray events;
+};
+
+#endif // AUTOMOCTRACE_H
@@ -0,0 +1,405 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Generates a synthetic project and measures how long automoc4 takes for a clean run, a run
+// where nothing changed and a run after a header was edited, and how much memory it needs. The
+// results are written as JSON.
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QProcess>
+#include <QtCore/QRegExp>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QtAlgorithms>
+#include <cstdlib>
+
+struct Result
+{
+    QString name;
+    QList<double> runs;  // milliseconds
+    qint64 peakMemory;   // kB, the most of all runs, 0 if automoc4 doesn't report it
+};
+
+class Benchmark
+{
+    public:
+        Benchmark();
+        bool run();
+
+    private:
+        bool parseOptions(const QStringList &args);
+        void printUsage(const QString &path);
+        void writeFile(const QString &path, const QByteArray &contents);
+        QByteArray padding(int index) const;
+        void generateProject();
+        void cleanBuildDir();
+        void editHeader();
+        bool runAutomoc4(double *msecs, qint64 *peakMemory);
+        bool measure(const QString &name, void (Benchmark::*prepare)());
+        QByteArray toJson() const;
+
+        QString automoc4;
+        QString moc;
+        QString workDir;
+        QString output;
+        QStringList extraArgs;
+        int sources;
+        int largeEvery;
+        int largeSize;
+        int repeat;
+
+        QString srcDir;
+        QString buildDir;
+        QString outfile;
+        QString editedHeader;
+        int edits;
+        int headers;
+        int largeFiles;
+        qint64 bytes;
+        QList<Result> results;
+        QTextStream cout;
+        QTextStream cerr;
+};
+
+Benchmark::Benchmark()
+    : sources(1000), largeEvery(50), largeSize(256 * 1024), repeat(5), edits(0), headers(0),
+    largeFiles(0), bytes(0), cout(stdout, QIODevice::WriteOnly), cerr(stderr, QIODevice::WriteOnly)
+{
+}
+
+void Benchmark::printUsage(const QString &path)
+{
+    cout << "Usage: " << path << " --automoc4 <automoc4> --moc <stub moc> --workdir <dir> [options] [-- <automoc4 options>]" << endl;
+    cout << "  --output <file>      write the results as JSON to <file>, the default is stdout" << endl;
+    cout << "  --sources <n>        number of source files, the default is 1000" << endl;
+    cout << "  --large-every <n>    make every n-th source and header large, 0 for none, the default is 50" << endl;
+    cout << "  --large-size <bytes> size of the large files, the default is 262144" << endl;
+    cout << "  --repeat <n>         runs per scenario, the default is 5" << endl;
+}
+
+bool Benchmark::parseOptions(const QStringList &args)
+{
+    for (int i = 1; i < args.size(); ++i) {
+        const QString &arg = args[i];
+        if (arg == QLatin1String("--")) {
+            extraArgs = args.mid(i + 1);
+            break;
+        }
+        if (i + 1 >= args.size()) {
+            return false;
+        }
+        const QString &value = args[++i];
+        bool ok = true;
+        if (arg == QLatin1String("--automoc4")) {
+            automoc4 = value;
+        } else if (arg == QLatin1String("--moc")) {
+            moc = value;
+        } else if (arg == QLatin1String("--workdir")) {
+            workDir = value;
+        } else if (arg == QLatin1String("--output")) {
+            output = value;
+        } else if (arg == QLatin1String("--sources")) {
+            sources = value.toInt(&ok);
+            ok = ok && sources > 0;
+        } else if (arg == QLatin1String("--large-every")) {
+            largeEvery = value.toInt(&ok);
+            ok = ok && largeEvery >= 0;
+        } else if (arg == QLatin1String("--large-size")) {
+            largeSize = value.toInt(&ok);
+            ok = ok && largeSize >= 0;
+        } else if (arg == QLatin1String("--repeat")) {
+            repeat = value.toInt(&ok);
+            ok = ok && repeat > 0;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return !automoc4.isEmpty() && !moc.isEmpty() && !workDir.isEmpty();
+}
+
+void Benchmark::writeFile(const QString &path, const QByteArray &contents)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(contents) != contents.size()) {
+        cerr << "automoc4_benchmark: could not write " << path << endl;
+        ::exit(EXIT_FAILURE);
+    }
+    bytes += contents.size();
+}
+
+QByteArray Benchmark::padding(int index) const
+{
+    // declarations and comments in front of the class, the scanner has to get through them
+    // before it finds Q_OBJECT
+    QByteArray result;
+    if (largeEvery == 0 || index % largeEvery != 0) {
+        return result;
+    }
+    int line = 0;
+    while (result.size() < largeSize) {
+        result += "// padding line " + QByteArray::number(line) + " of a large file\n";
+        result += "int padding_" + QByteArray::number(index) + '_' + QByteArray::number(line) +
+            "(int value) { return value * " + QByteArray::number(line) + "; }\n";
+        ++line;
+    }
+    return result;
+}
+
+void Benchmark::generateProject()
+{
+    // five kinds of files, in turn:
+    // 0: Q_OBJECT in the header, the moc is included in _automoc.cpp
+    // 1: Q_OBJECT in the header, the source includes moc_<name>.cpp
+    // 2: Q_OBJECT in the source, the source includes <name>.moc
+    // 3: no Q_OBJECT at all
+    // 4: Q_OBJECT in a header in a subdir, the source includes sub/moc_<name>.cpp
+    srcDir = QDir(workDir).absoluteFilePath(QLatin1String("src"));
+    buildDir = QDir(workDir).absoluteFilePath(QLatin1String("build"));
+    outfile = buildDir + QLatin1String("/benchmark_automoc.cpp");
+    QDir(workDir).mkpath(srcDir + QLatin1String("/sub"));
+    QDir(workDir).mkpath(buildDir);
+
+    QStringList sourceFiles;
+    for (int i = 0; i < sources; ++i) {
+        const int kind = i % 5;
+        const QByteArray name = "file" + QByteArray::number(i);
+        const QByteArray className = "File" + QByteArray::number(i);
+        const QByteArray pad = padding(i);
+        if (!pad.isEmpty()) {
+            largeFiles += 2;
+        }
+
+        QByteArray header = "#ifndef " + name.toUpper() + "_H\n#define " + name.toUpper() + "_H\n\n"
+            "#include <QtCore/QObject>\n\n" + pad;
+        if (kind == 2 || kind == 3) {
+            header += "class " + className + "\n{\n    public:\n        " + className + "();\n};\n";
+        } else {
+            header += "class " + className + " : public QObject\n{\n    Q_OBJECT\n    public:\n        " +
+                className + "();\n};\n";
+        }
+        header += "\n#endif\n";
+        const QString headerPath = srcDir + (kind == 4 ? "/sub/" : "/") + name + ".h";
+        writeFile(headerPath, header);
+        ++headers;
+        if (kind == 0 && editedHeader.isEmpty() && i >= sources / 2) {
+            editedHeader = headerPath;
+        }
+
+        QByteArray source = (kind == 4 ? "#include \"sub/" : "#include \"") + name + ".h\"\n\n" + pad;
+        if (kind == 2) {
+            source += "class " + className + "Private : public QObject\n{\n    Q_OBJECT\n};\n\n";
+        }
+        source += className + "::" + className + "()\n{\n}\n";
+        if (kind == 1) {
+            source += "\n#include \"moc_" + name + ".cpp\"\n";
+        } else if (kind == 2) {
+            source += "\n#include \"" + name + ".moc\"\n";
+        } else if (kind == 4) {
+            source += "\n#include \"sub/moc_" + name + ".cpp\"\n";
+        }
+        const QString sourcePath = srcDir + '/' + name + ".cpp";
+        writeFile(sourcePath, source);
+        sourceFiles << sourcePath;
+    }
+    if (editedHeader.isEmpty()) {
+        editedHeader = srcDir + QLatin1String("/file0.h");
+    }
+
+    // what automoc4.files.in becomes
+    const QByteArray dotFiles = "SOURCES:\n" + sourceFiles.join(QLatin1String(";")).toUtf8() +
+        "\nMOC_COMPILE_DEFINITIONS:\nQT_NO_DEBUG;AUTOMOC4_BENCHMARK\nMOC_DEFINITIONS:\n\nMOC_INCLUDES:\n" +
+        srcDir.toUtf8() + ';' + buildDir.toUtf8() +
+        "\nCMAKE_INCLUDE_DIRECTORIES_PROJECT_BEFORE:\n\nCMAKE_BINARY_DIR:\n" + buildDir.toUtf8() +
+        "\nCMAKE_SOURCE_DIR:\n" + srcDir.toUtf8() + '\n';
+    writeFile(outfile + QLatin1String(".files"), dotFiles);
+}
+
+void Benchmark::cleanBuildDir()
+{
+    // everything but the .files manifest
+    QDir dir(buildDir);
+    foreach (const QFileInfo &info, dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden)) {
+        if (info.isDir()) {
+            QDir sub(info.absoluteFilePath());
+            foreach (const QString &name, sub.entryList(QDir::Files | QDir::Hidden)) {
+                sub.remove(name);
+            }
+            dir.rmdir(info.fileName());
+        } else if (!info.fileName().endsWith(QLatin1String(".files"))) {
+            dir.remove(info.fileName());
+        }
+    }
+}
+
+void Benchmark::editHeader()
+{
+    // a changed size is noticed even where the timestamps are coarse
+    QFile file(editedHeader);
+    file.open(QIODevice::Append);
+    file.write("// edit " + QByteArray::number(++edits) + '\n');
+}
+
+bool Benchmark::runAutomoc4(double *msecs, qint64 *peakMemory)
+{
+    QProcess process;
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    // --stats reports the peak memory of automoc4
+    const QStringList args = QStringList() << outfile << srcDir << buildDir << moc
+        << QLatin1String("cmake") << QLatin1String("--stats") << extraArgs;
+    QElapsedTimer timer;
+    timer.start();
+    process.start(automoc4, args);
+    if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit ||
+            process.exitCode() != 0) {
+        cerr << "automoc4_benchmark: " << automoc4 << " failed:\n" << process.readAll() << endl;
+        return false;
+    }
+    *msecs = timer.nsecsElapsed() / 1000000.0;
+    QRegExp memoryLine(QLatin1String("peak memory: (\\d+) kB"));
+    *peakMemory = memoryLine.indexIn(QString::fromLocal8Bit(process.readAll())) >= 0 ?
+        memoryLine.cap(1).toLongLong() : 0;
+    return true;
+}
+
+bool Benchmark::measure(const QString &name, void (Benchmark::*prepare)())
+{
+    Result result;
+    result.name = name;
+    result.peakMemory = 0;
+    for (int i = 0; i < repeat; ++i) {
+        if (prepare) {
+            (this->*prepare)();
+        }
+        double msecs;
+        qint64 peakMemory;
+        if (!runAutomoc4(&msecs, &peakMemory)) {
+            return false;
+        }
+        result.runs << msecs;
+        result.peakMemory = qMax(result.peakMemory, peakMemory);
+    }
+    results << result;
+    return true;
+}
+
+static QByteArray jsonString(const QString &s)
+{
+    QByteArray result = "\"";
+    foreach (const QChar &c, s) {
+        if (c == QLatin1Char('"') || c == QLatin1Char('\\')) {
+            result += '\\';
+        }
+        if (c.unicode() < 0x20) {
+            result += "\\u00" + QByteArray::number(c.unicode(), 16).rightJustified(2, '0');
+        } else {
+            result += QString(c).toUtf8();
+        }
+    }
+    return result + '"';
+}
+
+static QByteArray jsonNumber(double value)
+{
+    return QByteArray::number(value, 'f', 3);
+}
+
+QByteArray Benchmark::toJson() const
+{
+    const int files = sources + headers;
+    QByteArray json = "{\n  \"automoc4\": " + jsonString(automoc4) + ",\n  \"project\": {\n"
+        "    \"sources\": " + QByteArray::number(sources) + ",\n"
+        "    \"headers\": " + QByteArray::number(headers) + ",\n"
+        "    \"large_files\": " + QByteArray::number(largeFiles) + ",\n"
+        "    \"bytes\": " + QByteArray::number(bytes) + "\n  },\n  \"scenarios\": [";
+    for (int i = 0; i < results.size(); ++i) {
+        const Result &result = results[i];
+        QList<double> sorted = result.runs;
+        qSort(sorted);
+        double sum = 0;
+        QByteArray runs;
+        foreach (double msecs, result.runs) {
+            sum += msecs;
+            runs += (runs.isEmpty() ? "" : ", ") + jsonNumber(msecs);
+        }
+        const double median = sorted.size() % 2 ? sorted[sorted.size() / 2] :
+            (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+        json += (i == 0 ? "\n" : ",\n");
+        json += "    {\n      \"name\": " + jsonString(result.name) + ",\n"
+            "      \"runs_ms\": [" + runs + "],\n"
+            "      \"min_ms\": " + jsonNumber(sorted.first()) + ",\n"
+            "      \"median_ms\": " + jsonNumber(median) + ",\n"
+            "      \"mean_ms\": " + jsonNumber(sum / sorted.size()) + ",\n"
+            "      \"files_per_second\": " + jsonNumber(median > 0 ? files * 1000.0 / median : 0) + ",\n"
+            "      \"peak_memory_kb\": " + QByteArray::number(result.peakMemory) + "\n    }";
+    }
+    return json + "\n  ]\n}\n";
+}
+
+bool Benchmark::run()
+{
+    const QStringList args = QCoreApplication::arguments();
+    if (!parseOptions(args)) {
+        printUsage(args[0]);
+        return false;
+    }
+
+    generateProject();
+    if (!measure(QLatin1String("clean"), &Benchmark::cleanBuildDir) ||
+            !measure(QLatin1String("noop"), 0) ||
+            !measure(QLatin1String("header_edit"), &Benchmark::editHeader)) {
+        return false;
+    }
+
+    const QByteArray json = toJson();
+    if (output.isEmpty()) {
+        cout << json << flush;
+    } else {
+        writeFile(output, json);
+        foreach (const Result &result, results) {
+            QList<double> sorted = result.runs;
+            qSort(sorted);
+            cout << result.name << ": " << sorted.first() << " ms best of " << sorted.size();
+            if (result.peakMemory > 0) {
+                cout << ", " << result.peakMemory << " kB peak memory";
+            }
+            cout << endl;
+        }
+        cout << "results written to " << output << endl;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    return Benchmark().run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,221 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "jobserver.h"
+
+#include <QtCore/QList>
+
+#ifndef Q_OS_WIN
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+JobServer::JobServer()
+    : readFd(-1), writeFd(-1), ownWriteFd(false)
+{
+}
+
+JobServer::~JobServer()
+{
+    disconnect();
+}
+
+void JobServer::disconnect()
+{
+    releaseAll();
+#ifndef Q_OS_WIN
+    if (readFd >= 0) {
+        ::close(readFd);
+    }
+    if (ownWriteFd) {
+        ::close(writeFd);
+    }
+#endif
+    readFd = -1;
+    writeFd = -1;
+    ownWriteFd = false;
+}
+
+#ifndef Q_OS_WIN
+static bool isFifo(int fd)
+{
+    struct stat info;
+    return ::fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+static bool isFifo(const QByteArray &path)
+{
+    struct stat info;
+    return ::stat(path.constData(), &info) == 0 && S_ISFIFO(info.st_mode);
+}
+#endif
+
+JobServer::Status JobServer::connect(const QByteArray &makeFlags, qint64 pid)
+{
+    disconnect();
+
+    // the last --jobserver-auth wins, make passes the options of the sub-make after the outer
+    // ones. Variable definitions follow a lone "--".
+    QByteArray auth;
+    foreach (const QByteArray &flag, makeFlags.split(' ')) {
+        if (flag == "--") {
+            break;
+        }
+        if (flag.startsWith("--jobserver-auth=")) {
+            auth = flag.mid(17);
+        } else if (flag.startsWith("--jobserver-fds=")) {
+            // make 4.1 and older
+            auth = flag.mid(16);
+        }
+    }
+    if (auth.isEmpty()) {
+        return None;
+    }
+#ifdef Q_OS_WIN
+    // make uses a named semaphore on Windows
+    Q_UNUSED(pid);
+    return Unusable;
+#else
+    if (auth.startsWith("fifo:")) {
+        const QByteArray path = auth.mid(5);
+        readFd = ::open(path.constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (readFd < 0) {
+            return Unusable;
+        }
+        writeFd = ::open(path.constData(), O_WRONLY | O_CLOEXEC);
+        if (writeFd < 0) {
+            ::close(readFd);
+            readFd = -1;
+            return Unusable;
+        }
+        ownWriteFd = true;
+        return Connected;
+    }
+
+    const QList<QByteArray> fds = auth.split(',');
+    bool readOk = false;
+    bool writeOk = false;
+    const int inheritedReadFd = fds.size() == 2 ? fds[0].toInt(&readOk) : -1;
+    const int inheritedWriteFd = fds.size() == 2 ? fds[1].toInt(&writeOk) : -1;
+    if (pid != 0) {
+        // the pipe of another process, e.g. of a client of the automoc4 server. It is reopened
+        // through /proc while that process waits with the pipe open.
+        const QByteArray fdDir = "/proc/" + QByteArray::number(pid) + "/fd/";
+        const QByteArray readPath = fdDir + QByteArray::number(inheritedReadFd);
+        const QByteArray writePath = fdDir + QByteArray::number(inheritedWriteFd);
+        if (!readOk || !writeOk || !isFifo(readPath) || !isFifo(writePath)) {
+            return Unusable;
+        }
+        readFd = ::open(readPath.constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (readFd < 0) {
+            return Unusable;
+        }
+        writeFd = ::open(writePath.constData(), O_WRONLY | O_CLOEXEC);
+        if (writeFd < 0) {
+            ::close(readFd);
+            readFd = -1;
+            return Unusable;
+        }
+        ownWriteFd = true;
+        return Connected;
+    }
+    // make closes the pipe for commands it doesn't consider recursive, the numbers may then
+    // belong to anything else
+    if (!readOk || !writeOk || !isFifo(inheritedReadFd) || !isFifo(inheritedWriteFd)) {
+        return Unusable;
+    }
+    // O_NONBLOCK on the inherited file description would change it for make and all other jobs
+    // as well, and reading blocking could hang when another job takes the token first. So the
+    // pipe is only usable where /proc gives an own file description for it, which rules out
+    // macOS and the BSDs. The fifo of make 4.4 works everywhere.
+    const QByteArray path = "/proc/self/fd/" + QByteArray::number(inheritedReadFd);
+    readFd = ::open(path.constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (readFd < 0) {
+        return Unusable;
+    }
+    // the mocs don't need the pipe
+    ::fcntl(inheritedReadFd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(inheritedWriteFd, F_SETFD, FD_CLOEXEC);
+    writeFd = inheritedWriteFd;
+    return Connected;
+#endif
+}
+
+bool JobServer::tryAcquire()
+{
+#ifndef Q_OS_WIN
+    if (readFd < 0) {
+        return false;
+    }
+    char token;
+    ssize_t n;
+    do {
+        n = ::read(readFd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n == 1) {
+        held += token;
+        return true;
+    }
+#endif
+    return false;
+}
+
+void JobServer::waitForToken(int msecs)
+{
+#ifndef Q_OS_WIN
+    if (readFd < 0) {
+        return;
+    }
+    struct pollfd fd;
+    fd.fd = readFd;
+    fd.events = POLLIN;
+    ::poll(&fd, 1, msecs);
+#endif
+}
+
+void JobServer::release()
+{
+    if (held.isEmpty()) {
+        return;
+    }
+    const char token = held.at(held.size() - 1);
+    held.chop(1);
+#ifndef Q_OS_WIN
+    ssize_t n;
+    do {
+        n = ::write(writeFd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+#endif
+}
+
+void JobServer::releaseAll()
+{
+    while (!held.isEmpty()) {
+        release();
+    }
+}
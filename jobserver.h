@@ -0,0 +1,67 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#include <QtCore/QByteArray>
+
+// A client of the jobserver of GNU make, so that the mocs of all automoc targets of a build
+// together stay within its -j. automoc4 may always run one moc on the job make started it with,
+// every further one needs a token read from the jobserver, which goes back when the moc is done.
+// Both the pipe of make up to 4.3 and the named fifo of make 4.4 are understood.
+class JobServer
+{
+    public:
+        enum Status { None, Connected, Unusable };
+
+        JobServer();
+        ~JobServer();
+
+        // finds the jobserver in MAKEFLAGS. Unusable means make announced one but automoc4 can't
+        // use it, e.g. because the recipe line was not marked as recursive, or because it is the
+        // pipe of make 4.3 or older on a system without /proc. The file descriptors of the pipe
+        // are those of the process pid, which make started, or of this one for 0.
+        Status connect(const QByteArray &makeFlags, qint64 pid = 0);
+        // gives all tokens back and forgets the jobserver
+        void disconnect();
+        bool isConnected() const { return readFd >= 0; }
+
+        // takes a token if one is free, without blocking
+        bool tryAcquire();
+        // waits up to msecs for a token to become free, it still has to be taken with tryAcquire
+        void waitForToken(int msecs);
+        void release();
+        void releaseAll();
+        int tokens() const { return held.size(); }
+
+    private:
+        int readFd;   // an own file description in nonblocking mode
+        int writeFd;
+        bool ownWriteFd;
+        QByteArray held;  // make may hand out different characters and wants them back
+};
+
+#endif // JOBSERVER_H
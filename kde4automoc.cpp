@@ -24,18 +24,27 @@
 */
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QHash>
+#include <QtCore/QPair>
 #include <QtCore/QProcess>
 #include <QtCore/QQueue>
-#include <QtCore/QRegExp>
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 #include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QFuture>
+#include <QtCore/QtConcurrentMap>
+#include <QtCore/QtAlgorithms>
 #include <QtCore/QtDebug>
 #include <cstdlib>
+#include <stdio.h>
 #include <sys/types.h>
 #include <time.h>
 #include <errno.h>
@@ -44,6 +53,9 @@
 #include <windows.h>
 #include <sys/utime.h>
 #else
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <utime.h>
 #endif
 
@@ -51,52 +63,478 @@
 #include <unistd.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 // currently this is only used for the version number, Alex
 #include "automoc4_config.h"
+#include "mocscanner.h"
+#include "automoctrace.h"
+#include "pathtable.h"
+#include "jobserver.h"
+#include "manifest.h"
+#ifdef AUTOMOC4_MOC_ENGINE
+#include "mocengine.h"
+#endif
+
+// what a moc output was generated from, kept in <outfile>.cache between runs
+struct MocFingerprint
+{
+    MocFingerprint() : inputSize(-1), inputMtime(0) {}
+
+    bool operator==(const MocFingerprint &other) const
+    {
+        return inputSize == other.inputSize && inputMtime == other.inputMtime &&
+            inputHash == other.inputHash && commandHash == other.commandHash;
+    }
+
+    qint64 inputSize;
+    qint64 inputMtime;
+    QByteArray inputHash;    // md5 of the contents of the source or header
+    QByteArray commandHash;  // md5 of the moc executable and the arguments
+};
+
+static QDataStream &operator<<(QDataStream &stream, const MocFingerprint &fingerprint)
+{
+    return stream << fingerprint.inputSize << fingerprint.inputMtime << fingerprint.inputHash
+        << fingerprint.commandHash;
+}
+
+static QDataStream &operator>>(QDataStream &stream, MocFingerprint &fingerprint)
+{
+    return stream >> fingerprint.inputSize >> fingerprint.inputMtime >> fingerprint.inputHash
+        >> fingerprint.commandHash;
+}
+
+// one moc run of the job pool: a moc process, or a child of the moc engine built into automoc4
+class MocProcess
+{
+    public:
+        MocProcess() : engine(0) {}
+        ~MocProcess();
+
+        bool start(const QString &mocExe, const QStringList &args);
+        bool startEngine(const QString &inputFile, const QString &outputFile);
+        bool isRunning();
+        void waitForFinished(int msecs);
+        void kill();
+        bool crashed() const;
+        int exitCode() const;
+        QByteArray readAllStandardOutput();
+        QByteArray readAllStandardError();
+        QString errorString() const;
+
+    private:
+        QProcess process;
+        class MocEngine *engine;
+};
+
+// one moc process of the job pool in AutoMoc::generateMoc
+struct MocJob
+{
+    QString sourceFile;
+    QString mocFilePath;
+    QString tempFilePath;  // moc writes here, the result replaces mocFilePath if it differs
+    MocFingerprint fingerprint;
+    bool inAutomocCpp;
+    QString message;
+    QString commandLine;
+    QString cacheEntry;  // where the output goes in the moc cache, empty without --moc-cache
+    MocProcess *process;  // 0 if the output was taken from the moc cache
+    bool started;
+    qint64 startUsecs;  // for --stats and --trace
+    int slot;           // the trace lane of the job
+};
+
+// scan result of a source or header file, kept in <outfile>.cache between runs
+struct ScanCacheEntry
+{
+    ScanCacheEntry() : size(-1), mtime(0), includesScanned(false), hasQObject(false) {}
+
+    qint64 size;
+    qint64 mtime;
+    QByteArray hash;
+    bool includesScanned;
+    bool hasQObject;  // Q_OBJECT or Q_GADGET outside of comments, strings and #if 0
+    QStringList mocIncludes;
+};
+
+static QDataStream &operator<<(QDataStream &stream, const ScanCacheEntry &entry)
+{
+    return stream << entry.size << entry.mtime << entry.hash << entry.includesScanned
+        << entry.hasQObject << entry.mocIncludes;
+}
+
+static QDataStream &operator>>(QDataStream &stream, ScanCacheEntry &entry)
+{
+    return stream >> entry.size >> entry.mtime >> entry.hash >> entry.includesScanned
+        >> entry.hasQObject >> entry.mocIncludes;
+}
+
+// a file read by a thread of the pool in AutoMoc::prescanFiles
+struct ScanJob
+{
+    QString fileName;
+    bool scanIncludes;
+    qint64 lastScanTime;
+    ScanCacheEntry entry;
+    qint64 bytes;
+    qint64 start;
+    qint64 end;
+};
+
+// the names in a directory, read once to answer all the header existence checks in it
+struct DirectoryListing
+{
+    DirectoryListing() : complete(false), caseSensitive(true) {}
+
+    bool complete;  // false if the directory could not be read, QFile::exists answers then
+    bool caseSensitive;
+    QSet<QString> names;  // lower case if the filesystem is not case sensitive
+};
+
+// thrown instead of exiting when automoc4 runs as a server, which has to survive broken targets
+struct FatalError
+{
+};
+
+MocProcess::~MocProcess()
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    delete engine;
+#endif
+}
+
+bool MocProcess::start(const QString &mocExe, const QStringList &args)
+{
+    process.start(mocExe, args, QIODevice::ReadOnly);
+    return process.waitForStarted();
+}
+
+bool MocProcess::startEngine(const QString &inputFile, const QString &outputFile)
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    engine = new MocEngine;
+    if (engine->start(inputFile, outputFile)) {
+        return true;
+    }
+    delete engine;
+    engine = 0;
+#else
+    Q_UNUSED(inputFile);
+    Q_UNUSED(outputFile);
+#endif
+    return false;
+}
+
+bool MocProcess::isRunning()
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        return engine->isRunning();
+    }
+#endif
+    // waitForFinished(0) makes QProcess notice a process that exited in the meantime
+    return process.state() != QProcess::NotRunning && !process.waitForFinished(0);
+}
+
+void MocProcess::waitForFinished(int msecs)
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        engine->waitForFinished(msecs);
+        return;
+    }
+#endif
+    process.waitForFinished(msecs);
+}
+
+void MocProcess::kill()
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        engine->kill();
+        return;
+    }
+#endif
+    if (process.state() != QProcess::NotRunning) {
+        process.kill();
+        process.waitForFinished(-1);
+    }
+}
+
+bool MocProcess::crashed() const
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        return engine->crashed();
+    }
+#endif
+    return process.exitStatus() != QProcess::NormalExit;
+}
+
+int MocProcess::exitCode() const
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        return engine->exitCode();
+    }
+#endif
+    return process.exitCode();
+}
+
+QByteArray MocProcess::readAllStandardOutput()
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        return engine->readAllStandardOutput();
+    }
+#endif
+    return process.readAllStandardOutput();
+}
+
+QByteArray MocProcess::readAllStandardError()
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        return engine->readAllStandardError();
+    }
+#endif
+    return process.readAllStandardError();
+}
+
+QString MocProcess::errorString() const
+{
+#ifdef AUTOMOC4_MOC_ENGINE
+    if (engine) {
+        return engine->errorString();
+    }
+#endif
+    return process.errorString();
+}
 
 class AutoMoc
 {
     public:
         AutoMoc();
+        ~AutoMoc();
         bool run();
+        // whether --check found something that would be regenerated
+        bool isStale() const { return stale; }
 
     private:
+        bool runArguments(const QStringList &args);
+        bool runServer();
+        bool runClient(bool *result);
+        void watchScannedFiles(qint64 requestTime);
+        bool watchDirectory(const QString &dir);
+        void processWatchEvents();
+        void fatal();
+        void abortMocJobs();
+        bool runTarget(const QString &outfileName, const QString &srcdirName,
+                const QString &builddirName);
+        bool processTarget(const QString &outfileName, const QString &srcdirName,
+                const QString &builddirName);
+        void beginPhase(const char *name);
+        void printTargetStats(const QString &outfileName);
+        void connectJobServer(const QByteArray &makeFlags, qint64 pid);
+        void writeTrace();
+        void addToPlan(const QString &output, const QString &source, const char *reason);
+        void writePlan();
         void dotFilesCheck(bool);
         void lazyInitMocDefinitions();
         void lazyInit();
+        QStringList mocArguments();
+        QStringList parseOptions(const QStringList &args);
         bool touch(const QString &filename);
-        bool generateMoc(const QString &sourceFile, const QString &mocFileName);
+        bool touchNewerThan(const QString &filename, const QString &reference);
+        bool nameExists(const QString &dir, const QString &name);
+        int existingHeader(int dir, const QString &baseName, const char *suffix, const QString &ext);
+        int includedMocHeader(const QString &absFilename, const QString &mocInclude,
+                const QStringList &headerExtensions);
+        bool updateDependencies(const QStringList &outputs, const QStringList &unchangedFiles);
+        bool writeDependencies(const QSet<QString> &allDependencies, const QStringList &outputs,
+                const QStringList &unchangedFiles);
+        QString shardFileName(const QString &outfileName, int shard) const;
+        bool writePrefixHeader(const QString &fileName, const QList<QStringList> &shards);
+        QStringList qtIncludesOfHeader(const QString &header);
+        QList<QStringList> shardMocs(const QString &outfileName,
+                const QHash<int, QString> &mocs) const;
+        bool generateMoc(const QString &sourceFile, const QString &mocFileName, bool inAutomocCpp);
+        QByteArray mocExeIdentity();
+        QString mocCacheEntry(const QString &sourceFile, const QString &mocFilePath,
+                const MocFingerprint &fingerprint) const;
+        bool fetchFromMocCache(const QString &cacheEntry, const QString &filePath);
+        void storeInMocCache(const QString &filePath, const QString &cacheEntry);
+        void trimMocCache(const QString &dir);
+        bool hashInput(const QString &inputFile, const MocFingerprint *previous,
+                MocFingerprint *fingerprint);
+        int collectMocJobs();
+        void waitForMocJobs(int maxRunning);
+        void waitForMocSlot();
+        void finishMocJob(MocJob *job);
+        bool replaceIfDifferent(const QString &tempFilePath, const QString &filePath, bool *changed);
+        void loadScanCache();
+        void saveScanCache();
+        void prescanFiles(const QStringList &files, bool scanIncludes);
+        QList<ScanJob> queueScans(const QStringList &files, bool scanIncludes);
+        QFuture<void> startScans(QList<ScanJob> &jobs);
+        void recordScans(const QList<ScanJob> &jobs);
+        ScanCacheEntry scanFile(const QString &absFilename, bool scanIncludes);
+        void recordScan(const QString &absFilename, const ScanCacheEntry &entry, qint64 bytes,
+                qint64 start, qint64 end, int lane);
         void printUsage(const QString &);
         void printVersion();
         void echoColor(const QString &msg)
         {
-            QProcess cmakeEcho;
-            cmakeEcho.setProcessChannelMode(QProcess::ForwardedChannels);
-            QStringList args(cmakeEchoColorArgs);
-            args << msg;
-            cmakeEcho.start(cmakeExecutable, args, QIODevice::NotOpen);
-            cmakeEcho.waitForFinished(-1);
+            // what "cmake -E cmake_echo_color --blue --bold" prints, without starting cmake
+            if (useColor) {
+                cout << "\033[1m\033[34m" << msg << "\033[0m\n";
+            } else {
+                cout << msg << '\n';
+            }
+        }
+        QTextStream &messages()
+        {
+            // the plan of --check --plan=- on stdout must stay valid JSON, so it gets stdout alone
+            return checkOnly && planFile == QLatin1String("-") ? cerr : cout;
         }
 
         QString builddir;
         QString mocExe;
         QStringList mocIncludes;
         QStringList mocDefinitions;
-        QStringList cmakeEchoColorArgs;
-        QString cmakeExecutable;
-        QFile dotFiles;
-        const bool verbose;
+        bool mocIncludesInitialized;
+        bool mocDefinitionsInitialized;
+        QString batchFile;
+        QString serverSocket;
+        QString clientSocket;
+        bool serverMode;
+        bool anythingChanged;  // whether a moc or _automoc.cpp file was written
+        int inotifyFd;
+        QHash<int, QString> watchedDirs;  // key = inotify watch descriptor
+        QSet<QString> watchedDirNames;
+        QFile stdoutFile;  // cout and cerr go back to these after a request of a client
+        QFile stderrFile;
+        QHash<QByteArray, QStringList> mocIncludesCache;  // key = the include lines of .files
+        Manifest dotFiles;
+        bool verbose;
+        bool quiet;
+        bool useColor;
         QTextStream cerr;
         QTextStream cout;
         bool failed;
-        bool automocCppChanged;
-        bool generateAll;
+        QSet<QString> changedMocs;  // mocs included in the _automoc.cpp files that were rewritten
+        int shardCount;
+        bool usePch;  // --pch: write a prefix header of the includes of the mocs
         bool doTouch;
+        QString depFile;
+        QString stampFile;
+        QSet<QString> dependencies;  // files and directories the result of the target depends on
+        // those in paths, by id. Their paths are only put together for the depfile.
+        QSet<int> headerDependencies;
+        QSet<int> dirDependencies;
+        // --batch writes one depfile for all its targets after the last one
+        QSet<QString> batchDependencies;
+        QStringList batchOutputs;
+        QStringList batchUnchangedFiles;
+        QHash<QString, DirectoryListing> dirListings;  // key = directory path
+        PathTable paths;  // the files of the current target
+        QString candidateName;  // reused for the names of candidate headers
+
+        // statistics of the current target, for --stats and --trace
+        bool stats;
+        QString traceFile;
+        AutoMocTrace trace;
+        const char *currentPhase;
+        qint64 phaseStart;
+        QList<QPair<QString, qint64> > phaseTimes;  // microseconds
+        int existenceChecks;
+        int directoriesRead;
+        int statCalls;
+        int filesRead;
+        qint64 bytesRead;
+        int scanCacheHits;
+        int qObjectMatches;
+        int mocIncludeMatches;
+        int mocProcesses;
+        int mocFailures;
+        int mocCacheHits;
+        qint64 mocProcessTime;
+        QSet<int> busyMocSlots;
+        int maxMocJobs;
+        JobServer jobServer;  // of make, shares the -j of the build with the other jobs
+        int mocsGenerated;
+        QQueue<MocJob *> mocJobs;
+        QFile scanCacheFile;
+        QHash<QString, ScanCacheEntry> scanCache;
+        QHash<QString, MocFingerprint> mocFingerprints;     // key = moc output filepath
+        QHash<QString, MocFingerprint> newMocFingerprints;  // the same for the mocs of this run
+        QByteArray mocCommandHash;
+        QHash<QString, QByteArray> mocExeIdentities;  // key = moc executable
+        QString mocCacheDir;
+        qint64 mocCacheSize;  // bytes
+        bool inProcessMoc;
+        bool checkOnly;  // --check: nothing is written, only what would be regenerated is reported
+        QString planFile;
+        QByteArray plan;  // the pending outputs found by --check, as JSON objects
+        bool stale;
+        QSet<QString> scannedFiles;
+        QHash<QString, ScanCacheEntry> sharedScans;  // files scanned by any target of this process
+        qint64 lastScanTime;
+        qint64 scanTime;
+        bool scanCacheChanged;
 };
 
 void AutoMoc::printUsage(const QString &path)
 {
-    cout << "Usage: " << path << " <outfile> <srcdir> <builddir> <moc executable> <cmake executable> [--touch]" << endl;
+    cout << "Usage: " << path << " <outfile> <srcdir> <builddir> <moc executable> <cmake executable> [--touch] [-j <jobs>] [--quiet]" << endl;
+    cout << "       " << path << " --batch <listfile> <moc executable> <cmake executable> [-j <jobs>] [--quiet]" << endl;
+    cout << "       " << path << " --server <socket>" << endl;
+    cout << "  --touch    make <outfile>.files newer than <outfile> when <outfile> was written" << endl;
+    cout << "  --depfile <depfile>  write the files and directories looked at to <depfile>, as" << endl;
+    cout << "             dependencies of the stamp file, or of <outfile> without --stamp. With" << endl;
+    cout << "             --batch one depfile covers all targets" << endl;
+    cout << "  --stamp <stampfile>  update <stampfile> after every successful run" << endl;
+    cout << "  --shards <n>  spread the mocs not included by a source over <n> files balanced by the" << endl;
+    cout << "             size of the mocs: <outfile> and, for foo.cpp, foo_1.cpp to foo_<n-1>.cpp" << endl;
+    cout << "  --pch      write the Qt includes of the mocs in <outfile> and the headers shared by several" << endl;
+    cout << "             mocs to a prefix header, for foo.cpp foo_pch.h, which is included first and can" << endl;
+    cout << "             be precompiled" << endl;
+    cout << "  --check    only find out whether anything would be regenerated, without running moc" << endl;
+    cout << "             or writing any file. The exit code is 0 if everything is up to date, 2 if" << endl;
+    cout << "             something would be regenerated and 1 on errors" << endl;
+    cout << "  --plan=<file>  with --check, write the outputs that would be regenerated, their sources" << endl;
+    cout << "             and the reasons to <file> as JSON, - writes to stdout and the messages of" << endl;
+    cout << "             automoc4 to stderr" << endl;
+    cout << "  --stats    print how long the phases of every target took and what they did" << endl;
+    cout << "  --trace=<file>  write the phases, file scans and moc processes to <file> in the" << endl;
+    cout << "             Chrome trace event format" << endl;
+    cout << "  --batch <listfile>  process all targets listed in <listfile>, one" << endl;
+    cout << "             <outfile>;<srcdir>;<builddir> line per target" << endl;
+    cout << "  --server <socket>  keep the scan results in memory and serve requests from clients" << endl;
+    cout << "             on the local socket, changed files are noticed with inotify" << endl;
+    cout << "  --client <socket>  let the server on <socket> do the work, if there is no server" << endl;
+    cout << "             the work is done as without this option" << endl;
+    cout << "  --moc-cache <dir>  take the output of moc from <dir> if the same moc, arguments and" << endl;
+    cout << "             input were seen before, from any build directory, and store it there" << endl;
+    cout << "             otherwise. The default is taken from the AUTOMOC4_MOC_CACHE environment" << endl;
+    cout << "             variable" << endl;
+    cout << "  --moc-cache-size <MiB>  the size the moc cache is kept below, the default is taken" << endl;
+    cout << "             from the AUTOMOC4_MOC_CACHE_SIZE environment variable or 512" << endl;
+    cout << "  --in-process-moc  run the moc engine built into automoc4 in a forked child instead of" << endl;
+    cout << "             starting the moc executable, if automoc4 was built with one" << endl;
+    cout << "  -j <jobs>  run up to <jobs> moc processes and read up to <jobs> files at the same time," << endl;
+    cout << "             the default is taken from the AUTOMOC4_JOBS environment variable or the" << endl;
+    cout << "             number of CPU cores. Under make -j every moc but the first also needs a" << endl;
+    cout << "             token from the jobserver of make, so all jobs of the build stay within its -j" << endl;
+    cout << "  --quiet    only print one summary line instead of a line for every generated moc" << endl;
 }
 
 void AutoMoc::printVersion()
@@ -108,78 +546,237 @@ void AutoMoc::dotFilesCheck(bool x)
 {
     if (!x) {
         cerr << "Error: syntax error in " << dotFiles.fileName() << endl;
-        ::exit(EXIT_FAILURE);
+        fatal();
+    }
+}
+
+void AutoMoc::fatal()
+{
+    if (serverMode) {
+        throw FatalError();
+    }
+    // exit() doesn't run the destructors. Mocs may already run while the sources are scanned,
+    // and make must get its tokens back.
+    abortMocJobs();
+    jobServer.releaseAll();
+    ::exit(EXIT_FAILURE);
+}
+
+static int defaultMocJobs()
+{
+    bool ok = false;
+    int jobs = qgetenv("AUTOMOC4_JOBS").toInt(&ok);
+    if (!ok || jobs < 1) {
+        jobs = QThread::idealThreadCount();
+    }
+    return qMax(jobs, 1);
+}
+
+static QString defaultMocCacheDir()
+{
+    return QFile::decodeName(qgetenv("AUTOMOC4_MOC_CACHE"));
+}
+
+static qint64 defaultMocCacheSize()
+{
+    bool ok = false;
+    const qint64 megabytes = qgetenv("AUTOMOC4_MOC_CACHE_SIZE").toLongLong(&ok);
+    return (ok && megabytes > 0 ? megabytes : 512) * 1024 * 1024;
+}
+
+static bool colorEnabled()
+{
+#ifdef Q_OS_WIN
+    return false;
+#else
+    // the rules "cmake -E cmake_echo_color --switch=$(COLOR)" uses for Makefile output
+    const QByteArray color = qgetenv("COLOR").toUpper();
+    if (!color.isEmpty() && color != "ON" && color != "1" && color != "YES" && color != "TRUE" &&
+            color != "Y") {
+        return false;
     }
+    const QByteArray term = qgetenv("TERM");
+    return !term.isEmpty() && term != "dumb" && qgetenv("EMACS") != "t";
+#endif
 }
 
 int main(int argc, char **argv)
 {
     QCoreApplication app(argc, argv);
-    if (!AutoMoc().run()) {
+    AutoMoc autoMoc;
+    if (!autoMoc.run()) {
         return EXIT_FAILURE;
     }
-    return 0;
+    return autoMoc.isStale() ? 2 : 0;
 }
 
 AutoMoc::AutoMoc()
-    : verbose(!qgetenv("VERBOSE").isEmpty()), cerr(stderr), cout(stdout), failed(false),
-    automocCppChanged(false), generateAll(false), doTouch(false)
+    : mocIncludesInitialized(false), mocDefinitionsInitialized(false), serverMode(false),
+    anythingChanged(false), inotifyFd(-1), verbose(!qgetenv("VERBOSE").isEmpty()), quiet(false),
+    useColor(colorEnabled()), cerr(stderr), cout(stdout), failed(false), shardCount(1),
+    usePch(false), doTouch(false), stats(false), currentPhase(0), phaseStart(0),
+    existenceChecks(0), directoriesRead(0), statCalls(0), filesRead(0), bytesRead(0),
+    scanCacheHits(0), qObjectMatches(0), mocIncludeMatches(0), mocProcesses(0), mocFailures(0),
+    mocCacheHits(0), mocProcessTime(0), maxMocJobs(defaultMocJobs()), mocsGenerated(0),
+    mocCacheDir(defaultMocCacheDir()), mocCacheSize(defaultMocCacheSize()), inProcessMoc(false),
+    checkOnly(false), stale(false), lastScanTime(0), scanTime(0), scanCacheChanged(false)
 {
-    const QByteArray colorEnv = qgetenv("COLOR");
-    cmakeEchoColorArgs << QLatin1String("-E") << QLatin1String("cmake_echo_color") 
-        << QLatin1String("--switch=") + colorEnv << QLatin1String("--blue")
-        << QLatin1String("--bold");
 }
 
-void AutoMoc::lazyInitMocDefinitions()
+AutoMoc::~AutoMoc()
 {
-    static bool done = false;
-    if (done) {
-        return;
+    abortMocJobs();
+}
+
+void AutoMoc::abortMocJobs()
+{
+    // only needed if a target was not finished, don't leave half written mocs behind
+    while (!mocJobs.isEmpty()) {
+        MocJob *job = mocJobs.dequeue();
+        if (job->process) {
+            job->process->kill();
+        }
+        QFile::remove(job->tempFilePath);
+        delete job->process;
+        delete job;
+    }
+}
+
+QStringList AutoMoc::parseOptions(const QStringList &args)
+{
+    // returns the positional arguments, options may be given anywhere after the program name
+    QStringList positional;
+    positional << args[0];
+    for (int i = 1; i < args.size(); ++i) {
+        const QString &arg = args[i];
+        if (arg == QLatin1String("--touch")) {
+            doTouch = true;
+        } else if (arg == QLatin1String("--quiet")) {
+            quiet = true;
+        } else if (arg == QLatin1String("--batch") && i + 1 < args.size()) {
+            batchFile = args[++i];
+        } else if (arg == QLatin1String("--depfile") && i + 1 < args.size()) {
+            depFile = args[++i];
+        } else if (arg == QLatin1String("--stamp") && i + 1 < args.size()) {
+            stampFile = args[++i];
+        } else if (arg == QLatin1String("--shards") && i + 1 < args.size()) {
+            bool ok = false;
+            shardCount = args[++i].toInt(&ok);
+            if (!ok || shardCount < 1) {
+                cerr << "automoc4: invalid number of shards \"" << args[i] << '"' << endl;
+                printUsage(args[0]);
+                fatal();
+            }
+        } else if (arg == QLatin1String("--pch")) {
+            usePch = true;
+        } else if (arg == QLatin1String("--moc-cache") && i + 1 < args.size()) {
+            mocCacheDir = args[++i];
+        } else if (arg == QLatin1String("--moc-cache-size") && i + 1 < args.size()) {
+            bool ok = false;
+            const qint64 megabytes = args[++i].toLongLong(&ok);
+            if (!ok || megabytes < 1) {
+                cerr << "automoc4: invalid moc cache size \"" << args[i] << '"' << endl;
+                printUsage(args[0]);
+                fatal();
+            }
+            mocCacheSize = megabytes * 1024 * 1024;
+        } else if (arg == QLatin1String("--in-process-moc")) {
+#ifdef AUTOMOC4_MOC_ENGINE
+            inProcessMoc = true;
+#else
+            if (verbose) {
+                cerr << "automoc4: built without the moc engine, --in-process-moc is ignored" << endl;
+            }
+#endif
+        } else if (arg == QLatin1String("--check")) {
+            checkOnly = true;
+        } else if (arg.startsWith(QLatin1String("--plan="))) {
+            planFile = arg.mid(7);
+        } else if (arg == QLatin1String("--plan") && i + 1 < args.size()) {
+            planFile = args[++i];
+        } else if (arg == QLatin1String("--stats")) {
+            stats = true;
+        } else if (arg.startsWith(QLatin1String("--trace="))) {
+            traceFile = arg.mid(8);
+        } else if (arg == QLatin1String("--trace") && i + 1 < args.size()) {
+            traceFile = args[++i];
+        } else if (arg.startsWith(QLatin1String("-j"))) {
+            QString jobs = arg.mid(2);
+            if (jobs.isEmpty() && i + 1 < args.size()) {
+                jobs = args[++i];
+            }
+            bool ok = false;
+            const int n = jobs.toInt(&ok);
+            if (!ok || n < 1) {
+                cerr << "automoc4: invalid number of jobs \"" << jobs << '"' << endl;
+                printUsage(args[0]);
+                fatal();
+            }
+            maxMocJobs = n;
+        } else if (arg == QLatin1String("--server") && i + 1 < args.size()) {
+            serverSocket = args[++i];
+        } else if (arg == QLatin1String("--client") && i + 1 < args.size()) {
+            clientSocket = args[++i];
+        } else {
+            positional << arg;
+        }
     }
-    done = true;
-    QByteArray line = dotFiles.readLine();
-    dotFilesCheck(line == "MOC_COMPILE_DEFINITIONS:\n");
-    line = dotFiles.readLine().trimmed();
-    const QStringList &cdefList = QString::fromUtf8(line).split(';', QString::SkipEmptyParts);
-    line = dotFiles.readLine();
-    dotFilesCheck(line == "MOC_DEFINITIONS:\n");
-    line = dotFiles.readLine().trimmed();
-    if (!cdefList.isEmpty()) {
-        foreach (const QString &def, cdefList) {
-            Q_ASSERT(!def.isEmpty());
-            mocDefinitions << QLatin1String("-D") + def;
+    return positional;
+}
+
+static QList<QByteArray> manifestDefinitions(const Manifest &manifest)
+{
+    // the -D arguments of moc: the COMPILE_DEFINITIONS of the directory, or else the -D flags of
+    // add_definitions()
+    QList<QByteArray> definitions;
+    foreach (const QByteArray &def, manifest.section(Manifest::CompileDefinitions).trimmed().split(';')) {
+        if (!def.isEmpty()) {
+            definitions << "-D" + def;
         }
-    } else {
-        const QStringList &defList = QString::fromUtf8(line).split(' ', QString::SkipEmptyParts);
-        foreach (const QString &def, defList) {
-            Q_ASSERT(!def.isEmpty());
-            if (def.startsWith(QLatin1String("-D"))) {
-                mocDefinitions << def;
+    }
+    if (definitions.isEmpty()) {
+        foreach (const QByteArray &def, manifest.section(Manifest::Definitions).trimmed().split(' ')) {
+            if (def.startsWith("-D")) {
+                definitions << def;
             }
         }
     }
+    return definitions;
 }
 
-void AutoMoc::lazyInit()
+void AutoMoc::lazyInitMocDefinitions()
 {
-    const QStringList &args = QCoreApplication::arguments();
+    if (mocDefinitionsInitialized) {
+        return;
+    }
+    mocDefinitionsInitialized = true;
+    foreach (const QByteArray &def, manifestDefinitions(dotFiles)) {
+        mocDefinitions << QString::fromUtf8(def);
+    }
+}
 
-    mocExe = args[4];
-    cmakeExecutable = args[5];
+void AutoMoc::lazyInit()
+{
+    lazyInitMocDefinitions();
 
-    if (args.size() > 6) {
-        if (args[6] == QLatin1String("--touch")) {
-            doTouch = true;
-        }
+    const QByteArray incLine = dotFiles.section(Manifest::Includes).trimmed();
+    const bool projectBefore = (dotFiles.section(Manifest::ProjectBefore).trimmed() == "ON");
+    QByteArray binDirLine;
+    QByteArray srcDirLine;
+    if (projectBefore) {
+        binDirLine = dotFiles.section(Manifest::BinaryDir).trimmed();
+        srcDirLine = dotFiles.section(Manifest::SourceDir).trimmed();
     }
 
-    lazyInitMocDefinitions();
+    // the targets of a batch run mostly share their include directories
+    const QByteArray cacheKey = incLine + '\n' + binDirLine + '\n' + srcDirLine;
+    const QHash<QByteArray, QStringList>::ConstIterator cached = mocIncludesCache.constFind(cacheKey);
+    if (cached != mocIncludesCache.constEnd()) {
+        mocIncludes = cached.value();
+        return;
+    }
 
-    QByteArray line = dotFiles.readLine();
-    dotFilesCheck(line == "MOC_INCLUDES:\n");
-    line = dotFiles.readLine().trimmed();
-    const QStringList &incPaths = QString::fromUtf8(line).split(';', QString::SkipEmptyParts);
+    const QStringList &incPaths = QString::fromUtf8(incLine).split(';', QString::SkipEmptyParts);
     QSet<QString> frameworkPaths;
     foreach (const QString &path, incPaths) {
         Q_ASSERT(!path.isEmpty());
@@ -197,17 +794,9 @@ void AutoMoc::lazyInit()
         mocIncludes << "-F" << path;
     }
 
-    line = dotFiles.readLine();
-    dotFilesCheck(line == "CMAKE_INCLUDE_DIRECTORIES_PROJECT_BEFORE:\n");
-    line = dotFiles.readLine();
-    if (line == "ON\n") {
-        line = dotFiles.readLine();
-        dotFilesCheck(line == "CMAKE_BINARY_DIR:\n");
-        const QString &binDir = QLatin1String("-I") + QString::fromUtf8(dotFiles.readLine().trimmed());
-
-        line = dotFiles.readLine();
-        dotFilesCheck(line == "CMAKE_SOURCE_DIR:\n");
-        const QString &srcDir = QLatin1String("-I") + QString::fromUtf8(dotFiles.readLine().trimmed());
+    if (projectBefore) {
+        const QString &binDir = QLatin1String("-I") + QString::fromUtf8(binDirLine);
+        const QString &srcDir = QLatin1String("-I") + QString::fromUtf8(srcDirLine);
 
         QStringList sortedMocIncludes;
         QMutableListIterator<QString> it(mocIncludes);
@@ -227,12 +816,26 @@ void AutoMoc::lazyInit()
         sortedMocIncludes += mocIncludes;
         mocIncludes = sortedMocIncludes;
     }
+    mocIncludesCache.insert(cacheKey, mocIncludes);
+}
+
+QStringList AutoMoc::mocArguments()
+{
+    if (!mocIncludesInitialized) {
+        mocIncludesInitialized = true;
+        lazyInit();
+    }
+    QStringList args(mocIncludes + mocDefinitions);
+#ifdef Q_OS_WIN
+    args << "-DWIN32";
+#endif
+    return args;
 }
 
 bool AutoMoc::run()
 {
-    const QStringList &args = QCoreApplication::arguments();
-    Q_ASSERT(args.size() > 0);
+    Q_ASSERT(QCoreApplication::arguments().size() > 0);
+    const QStringList &args = parseOptions(QCoreApplication::arguments());
     if (args.size() == 2) {
         if ((args[1]=="--help") || (args[1]=="-h")) {
         printUsage(args[0]);
@@ -247,160 +850,470 @@ bool AutoMoc::run()
        ::exit(EXIT_FAILURE);
         }
     }
-    else if (args.size() < 6) {
-        printUsage(args[0]);
-       ::exit(EXIT_FAILURE);
-    }
-    QFile outfile(args[1]);
-    const QFileInfo outfileInfo(outfile);
 
-    QString srcdir(args[2]);
-    if (!srcdir.endsWith('/')) {
-        srcdir += '/';
+    if (!serverSocket.isEmpty()) {
+        return runServer();
     }
-    builddir = args[3];
-    if (!builddir.endsWith('/')) {
-        builddir += '/';
+    if (!clientSocket.isEmpty()) {
+        bool result = false;
+        if (runClient(&result)) {
+            return result;
+        }
+        // no server is running, do the work in this process
     }
+    connectJobServer(qgetenv("MAKEFLAGS"), 0);
+    trace.setEnabled(!traceFile.isEmpty());
+    const bool result = runArguments(args);
+    writeTrace();
+    writePlan();
+    return result;
+}
 
-    dotFiles.setFileName(args[1] + QLatin1String(".files"));
-    dotFiles.open(QIODevice::ReadOnly | QIODevice::Text);
-
-    const QByteArray &line = dotFiles.readLine();
-    dotFilesCheck(line == "SOURCES:\n");
-    const QStringList &sourceFiles = QString::fromUtf8(dotFiles.readLine().trimmed()).split(';', QString::SkipEmptyParts);
-
-    if (outfile.exists()) {
-        // set generateAll = true if MOC_COMPILE_DEFINITIONS changed
-        outfile.open(QIODevice::ReadOnly | QIODevice::Text);
-        QByteArray buf = outfile.readLine();
-        // the second line contains the joined mocDefinitions
-        buf = outfile.readLine();
-        buf.chop(1); // remove trailing \n
-        lazyInitMocDefinitions();
-        generateAll = (buf != mocDefinitions.join(QString(QLatin1Char(' '))).toUtf8());
-        outfile.close();
-    } else {
-        generateAll = true;
+void AutoMoc::connectJobServer(const QByteArray &makeFlags, qint64 pid)
+{
+    if (jobServer.connect(makeFlags, pid) == JobServer::Unusable) {
+        // what make itself does in this case. --jobs only counts when make announced no jobserver
+        if (verbose) {
+            cerr << "automoc4: the jobserver of make can't be used, running one moc at a time" << endl;
+        }
+        maxMocJobs = 1;
     }
+}
 
-    // the program goes through all .cpp files to see which moc files are included. It is not really
-    // interesting how the moc file is named, but what file the moc is created from. Once a moc is
-    // included the same moc may not be included in the _automoc.cpp file anymore. OTOH if there's a
-    // header containing Q_OBJECT where no corresponding moc file is included anywhere a
-    // moc_<filename>.cpp file is created and included in the _automoc.cpp file.
-    QHash<QString, QString> includedMocs;    // key = moc source filepath, value = moc output filepath
-    QHash<QString, QString> notIncludedMocs; // key = moc source filepath, value = moc output filename
+void AutoMoc::writeTrace()
+{
+    if (trace.isEnabled() && !trace.write(traceFile)) {
+        cerr << "automoc4: could not write " << traceFile << endl;
+    }
+}
 
-    QRegExp mocIncludeRegExp(QLatin1String("[\n]\\s*#\\s*include\\s+[\"<]((?:[^ \">]+/)?moc_[^ \">/]+\\.cpp|[^ \">]+\\.moc)[\">]"));
-    QRegExp qObjectRegExp(QLatin1String("[\n]\\s*Q_OBJECT\\b"));
-    QStringList headerExtensions;
-#if defined(Q_OS_WIN)
-    // not case sensitive
-    headerExtensions << ".h" << ".hpp" << ".hxx";
-#elif defined(Q_OS_DARWIN) || defined(Q_OS_MAC)
-    headerExtensions << ".h" << ".hpp" << ".hxx";
+void AutoMoc::addToPlan(const QString &output, const QString &source, const char *reason)
+{
+    stale = true;
+    if (verbose) {
+        messages() << "automoc4: " << output << " would be regenerated (" << reason << ")" << endl;
+    }
+    if (!plan.isEmpty()) {
+        plan += ",\n";
+    }
+    const QByteArray fields = AutoMocTrace::arg("output", output) +
+        AutoMocTrace::arg("source", source) + AutoMocTrace::arg("reason", QLatin1String(reason));
+    // every arg() ends with a comma
+    plan += "  {" + fields.left(fields.size() - 1) + '}';
+}
 
-    // detect case-sensitive filesystem
-    long caseSensitive = pathconf(srcdir.toLocal8Bit(), _PC_CASE_SENSITIVE);
-    if (caseSensitive == 1) {
-        headerExtensions << ".H";
+void AutoMoc::writePlan()
+{
+    if (!checkOnly || planFile.isEmpty()) {
+        return;
     }
-#else
-    headerExtensions << ".h" << ".hpp" << ".hxx" << ".H";
-#endif
-    /* not safe: if a moc file is missing it's hard to get it generated if this check is "active"
-    const QDateTime &lastRun = QFileInfo(dotFiles).lastModified();
-    if (!generateAll) {
-        bool dirty = false;
-        foreach (const QString &absFilename, sourceFiles) {
-            const QFileInfo sourceFileInfo(absFilename);
-            if (sourceFileInfo.lastModified() >= lastRun) {
-                dirty = true;
-                break;
+    const QByteArray contents = QByteArray("{\"up_to_date\":") + (stale ? "false" : "true") +
+        ",\"pending\":[" + (plan.isEmpty() ? "" : "\n") + plan + "\n]}\n";
+    plan.clear();
+    if (planFile == QLatin1String("-")) {
+        cout << contents << flush;
+        return;
+    }
+    QFile file(planFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(contents) != contents.size()) {
+        cerr << "automoc4: could not write " << planFile << endl;
+    }
+}
+
+bool AutoMoc::runArguments(const QStringList &args)
+{
+    if (!batchFile.isEmpty()) {
+        // one process for many targets, the scan results of shared headers and the moc
+        // arguments are reused across the targets
+        if (args.size() < 3) {
+            printUsage(args[0]);
+            fatal();
+        }
+        mocExe = args[1];
+        QFile list(batchFile);
+        if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            cerr << "automoc4: could not open " << batchFile << endl;
+            return false;
+        }
+        batchDependencies.clear();
+        batchOutputs.clear();
+        batchUnchangedFiles.clear();
+        bool success = true;
+        while (!list.atEnd()) {
+            const QString line = QString::fromUtf8(list.readLine().trimmed());
+            if (line.isEmpty()) {
+                continue;
             }
-            const QString &absPathBaseName = sourceFileInfo.absolutePath() + QLatin1Char('/') + sourceFileInfo.completeBaseName();
-            foreach (const QString &ext, headerExtensions) {
-                const QFileInfo header(absPathBaseName + ext);
-                if (header.exists() && header.lastModified() >= lastRun) {
-                    dirty = true;
-                    break;
-                }
-                const QFileInfo pheader(absPathBaseName + QLatin1String("_p") + ext);
-                if (pheader.exists() && pheader.lastModified() >= lastRun) {
-                    dirty = true;
-                    break;
-                }
+            const QStringList fields = line.split(';');
+            if (fields.size() != 3) {
+                cerr << "Error: syntax error in " << batchFile << endl;
+                return false;
             }
-            if (dirty) {
-                break;
+            if (!runTarget(fields[0], fields[1], fields[2])) {
+                success = false;
             }
         }
-        if (!dirty) {
-            return true;
+        // without a depfile or stamp file a failed target runs the batch again next time
+        if (success && !checkOnly) {
+            success = writeDependencies(batchDependencies, batchOutputs, batchUnchangedFiles);
         }
+        return success;
     }
-    */
 
-    foreach (const QString &absFilename, sourceFiles) {
-        //qDebug() << absFilename;
-        const QFileInfo sourceFileInfo(absFilename);
-        if (absFilename.endsWith(QLatin1String(".cpp")) || absFilename.endsWith(QLatin1String(".cc")) || 
-            absFilename.endsWith(QLatin1String(".mm")) || absFilename.endsWith(QLatin1String(".cxx")) ||
-            absFilename.endsWith(QLatin1String(".C"))) {
-            //qDebug() << "check .cpp file";
-            QFile sourceFile(absFilename);
-            sourceFile.open(QIODevice::ReadOnly);
-            const QByteArray contents = sourceFile.readAll();
-            if (contents.isEmpty()) {
-                cerr << "automoc4: empty source file: " << absFilename << endl;
-                continue;
-            }
-            const QString contentsString = QString::fromUtf8(contents);
-            const QString absPath = sourceFileInfo.absolutePath() + '/';
-            Q_ASSERT(absPath.endsWith('/'));
-            int matchOffset = mocIncludeRegExp.indexIn(contentsString);
-            if (matchOffset < 0) {
-                // no moc #include, look whether we need to create a moc from the .h nevertheless
-                //qDebug() << "no moc #include in the .cpp file";
-                const QString basename = sourceFileInfo.completeBaseName();
-                foreach (const QString &ext, headerExtensions) {
-                    const QString headername = absPath + basename + ext;
-                    if (QFile::exists(headername) && !includedMocs.contains(headername) &&
-                            !notIncludedMocs.contains(headername)) {
-                        const QString currentMoc = "moc_" + basename + ".cpp";
-                        QFile header(headername);
-                        header.open(QIODevice::ReadOnly);
-                        const QByteArray contents = header.readAll();
-                        if (qObjectRegExp.indexIn(QString::fromUtf8(contents)) >= 0) {
-                            //qDebug() << "header contains Q_OBJECT macro";
-                            notIncludedMocs.insert(headername, currentMoc);
-                        }
-                        break;
-                    }
-                }
+    if (args.size() < 6) {
+        printUsage(args[0]);
+        fatal();
+    }
+    mocExe = args[4];
+    // args[5] is the cmake executable, it used to print the colored messages
+    return runTarget(args[1], args[2], args[3]);
+}
+
+static qint64 peakMemory()
+{
+    // the peak resident set size of automoc4 in kB, 0 if it is not known
+#ifdef Q_OS_WIN
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(Q_OS_DARWIN) || defined(Q_OS_MAC)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+bool AutoMoc::runTarget(const QString &outfileName, const QString &srcdirName,
+        const QString &builddirName)
+{
+    const qint64 start = AutoMocTrace::now();
+    currentPhase = 0;
+    phaseTimes.clear();
+    existenceChecks = 0;
+    directoriesRead = 0;
+    statCalls = 0;
+    filesRead = 0;
+    bytesRead = 0;
+    scanCacheHits = 0;
+    qObjectMatches = 0;
+    mocIncludeMatches = 0;
+    mocProcesses = 0;
+    mocFailures = 0;
+    mocCacheHits = 0;
+    mocProcessTime = 0;
+
+    const bool result = processTarget(outfileName, srcdirName, builddirName);
+
+    beginPhase(0);
+    if (trace.isEnabled()) {
+        trace.complete(QFileInfo(outfileName).fileName(), "target", start, AutoMocTrace::now(), 0,
+                AutoMocTrace::arg("outfile", outfileName) +
+                AutoMocTrace::arg("stat_calls", statCalls) +
+                AutoMocTrace::arg("existence_checks", existenceChecks) +
+                AutoMocTrace::arg("directories_read", directoriesRead) +
+                AutoMocTrace::arg("files_read", filesRead) +
+                AutoMocTrace::arg("bytes_read", bytesRead) +
+                AutoMocTrace::arg("scan_cache_hits", scanCacheHits) +
+                AutoMocTrace::arg("q_object_matches", qObjectMatches) +
+                AutoMocTrace::arg("moc_include_matches", mocIncludeMatches) +
+                AutoMocTrace::arg("moc_processes", mocProcesses) +
+                AutoMocTrace::arg("moc_failures", mocFailures) +
+                AutoMocTrace::arg("moc_cache_hits", mocCacheHits) +
+                AutoMocTrace::arg("peak_memory_kb", peakMemory()) +
+                AutoMocTrace::arg("result", result ? 0 : 1));
+    }
+    if (stats) {
+        printTargetStats(outfileName);
+    }
+    return result;
+}
+
+void AutoMoc::beginPhase(const char *name)
+{
+    // ends the current phase, if any
+    const qint64 now = AutoMocTrace::now();
+    if (currentPhase) {
+        phaseTimes << qMakePair(QString::fromLatin1(currentPhase), now - phaseStart);
+        trace.complete(QString::fromLatin1(currentPhase), "phase", phaseStart, now);
+    }
+    currentPhase = name;
+    phaseStart = now;
+}
+
+static QString milliseconds(qint64 usecs)
+{
+    return QString::number(usecs / 1000.0, 'f', 1) + QLatin1String(" ms");
+}
+
+void AutoMoc::printTargetStats(const QString &outfileName)
+{
+    QTextStream &out = messages();
+    out << "automoc4: statistics for " << QFileInfo(outfileName).fileName() << '\n';
+    for (int i = 0; i < phaseTimes.size(); ++i) {
+        const QString &phase = phaseTimes[i].first;
+        out << "  " << phase.leftJustified(16) << milliseconds(phaseTimes[i].second).rightJustified(10);
+        if (phase == QLatin1String("scan")) {
+            out << "  " << filesRead << " files read (" << bytesRead << " bytes), " << scanCacheHits
+                << " unchanged";
+        } else if (phase == QLatin1String("moc")) {
+            out << "  " << mocProcesses << " moc processes (" << milliseconds(mocProcessTime)
+                << " in total), " << mocFailures << " failed, " << mocCacheHits
+                << " from the moc cache";
+        }
+        out << '\n';
+    }
+    out << "  " << statCalls << " stat calls, " << existenceChecks
+        << " header existence checks answered from " << directoriesRead << " directory listings, "
+        << qObjectMatches << " Q_OBJECT matches, " << mocIncludeMatches << " moc include matches"
+        << endl;
+    const qint64 memory = peakMemory();
+    if (memory > 0) {
+        // of the whole process so far, in a batch run it includes the earlier targets
+        out << "  peak memory: " << memory << " kB" << endl;
+    }
+}
+
+static bool isSourceFile(const QString &fileName)
+{
+    return fileName.endsWith(QLatin1String(".cpp")) || fileName.endsWith(QLatin1String(".cc")) ||
+        fileName.endsWith(QLatin1String(".mm")) || fileName.endsWith(QLatin1String(".cxx")) ||
+        fileName.endsWith(QLatin1String(".C"));
+}
+
+static QByteArray definitionsComment(const Manifest &manifest)
+{
+    // the definitions of the moc arguments as the comment at the top of the _automoc.cpp files,
+    // straight from the manifest, so that they don't have to be converted when no moc runs
+    QByteArray comment;
+    foreach (const QByteArray &def, manifestDefinitions(manifest)) {
+        if (!comment.isEmpty()) {
+            comment += ' ';
+        }
+        comment += def;
+    }
+    return comment;
+}
+
+static QString ownMocInclude(const ScanCacheEntry &sourceScan)
+{
+    // the moc include the moc of the source itself is generated for: the last one of the foo.moc
+    // style, if the source contains Q_OBJECT
+    if (sourceScan.size <= 0 || !sourceScan.hasQObject) {
+        return QString();
+    }
+    for (int i = sourceScan.mocIncludes.size() - 1; i >= 0; --i) {
+        const QString &mocInclude = sourceScan.mocIncludes[i];
+        if (!QFileInfo(mocInclude).completeBaseName().startsWith(QLatin1String("moc_"))) {
+            return mocInclude;
+        }
+    }
+    return QString();
+}
+
+bool AutoMoc::processTarget(const QString &outfileName, const QString &srcdirName,
+        const QString &builddirName)
+{
+    beginPhase("read manifest");
+
+    // reset everything that belongs to the previous target of a batch run
+    dotFiles.close();
+    mocIncludes.clear();
+    mocDefinitions.clear();
+    mocIncludesInitialized = false;
+    mocDefinitionsInitialized = false;
+    failed = false;
+    changedMocs.clear();
+    mocsGenerated = 0;
+    scanCache.clear();
+    mocFingerprints.clear();
+    newMocFingerprints.clear();
+    mocCommandHash.clear();
+    scannedFiles.clear();
+    dependencies.clear();
+    headerDependencies.clear();
+    dirDependencies.clear();
+    paths.clear();
+    candidateName.reserve(256);
+    lastScanTime = 0;
+    scanCacheChanged = false;
+
+    const QFileInfo outfileInfo(outfileName);
+
+    QString srcdir(srcdirName);
+    if (!srcdir.endsWith('/')) {
+        srcdir += '/';
+    }
+    builddir = builddirName;
+    if (!builddir.endsWith('/')) {
+        builddir += '/';
+    }
+
+    dotFilesCheck(dotFiles.open(outfileName + QLatin1String(".files")));
+    const QStringList &sourceFiles = QString::fromUtf8(dotFiles.section(Manifest::Sources).trimmed()).split(';', QString::SkipEmptyParts);
+    dependencies.insert(dotFiles.fileName());
+    if (QFileInfo(mocExe).isAbsolute()) {
+        dependencies.insert(mocExe);
+    }
+    foreach (const QString &absFilename, sourceFiles) {
+        dependencies.insert(absFilename);
+    }
+
+    // the program goes through all .cpp files to see which moc files are included. It is not really
+    // interesting how the moc file is named, but what file the moc is created from. Once a moc is
+    // included the same moc may not be included in the _automoc.cpp file anymore. OTOH if there's a
+    // header containing Q_OBJECT where no corresponding moc file is included anywhere a
+    // moc_<filename>.cpp file is created and included in the _automoc.cpp file.
+    QHash<int, QString> includedMocs;    // key = moc source in paths, value = moc output filepath
+    QHash<int, QString> notIncludedMocs; // key = moc source in paths, value = moc output filename
+
+    QStringList headerExtensions;
+#if defined(Q_OS_WIN)
+    // not case sensitive
+    headerExtensions << ".h" << ".hpp" << ".hxx";
+#elif defined(Q_OS_DARWIN) || defined(Q_OS_MAC)
+    headerExtensions << ".h" << ".hpp" << ".hxx";
+
+    // detect case-sensitive filesystem
+    long caseSensitive = pathconf(srcdir.toLocal8Bit(), _PC_CASE_SENSITIVE);
+    if (caseSensitive == 1) {
+        headerExtensions << ".H";
+    }
+#else
+    headerExtensions << ".h" << ".hpp" << ".hxx" << ".H";
+#endif
+
+    // source and header files which did not change since the last run are not read again, their
+    // scan results come from the cache. The mocs generated from them are still checked in
+    // generateMoc, so deleted moc files get regenerated.
+    beginPhase("load scan cache");
+    scanCacheFile.setFileName(outfileName + QLatin1String(".cache"));
+    loadScanCache();
+
+    beginPhase("scan");
+
+    // the files are read by a pool of threads first: the sources, then the headers the loop below
+    // will look at for the sources without a moc include. The loop itself still goes through the
+    // files one by one and finds all the scan results ready, so the order of the files decides
+    // exactly as before which moc ends up where.
+    QStringList scanSources;
+    foreach (const QString &absFilename, sourceFiles) {
+        if (isSourceFile(absFilename)) {
+            scanSources << absFilename;
+        }
+    }
+    prescanFiles(scanSources, true);
+    QStringList scanHeaders;
+    foreach (const QString &absFilename, scanSources) {
+        const ScanCacheEntry &sourceScan = scanCache[absFilename];
+        if (sourceScan.size <= 0 || !sourceScan.mocIncludes.isEmpty()) {
+            continue;
+        }
+        const QFileInfo sourceFileInfo(absFilename);
+        const int dir = paths.insertDir(sourceFileInfo.absolutePath());
+        const QString basename = sourceFileInfo.completeBaseName();
+        foreach (const QString &ext, headerExtensions) {
+            const int header = existingHeader(dir, basename, "", ext);
+            if (header >= 0) {
+                scanHeaders << paths.path(header);
+                break;
+            }
+        }
+        foreach (const QString &ext, headerExtensions) {
+            const int header = existingHeader(dir, basename, "_p", ext);
+            if (header >= 0) {
+                scanHeaders << paths.path(header);
+                break;
+            }
+        }
+    }
+
+    // a moc include without a header to generate the moc from is an error, and no moc must be
+    // written before it is found. It only takes the directory listings, so all of them are
+    // looked at before the first moc is started.
+    foreach (const QString &absFilename, scanSources) {
+        const ScanCacheEntry &sourceScan = scanCache[absFilename];
+        if (sourceScan.size <= 0) {
+            continue;
+        }
+        foreach (const QString &currentMoc, sourceScan.mocIncludes) {
+            if (QFileInfo(currentMoc).completeBaseName().startsWith(QLatin1String("moc_")) ||
+                    !sourceScan.hasQObject) {
+                includedMocHeader(absFilename, currentMoc, headerExtensions);
+            }
+        }
+    }
+
+    // a source containing Q_OBJECT that includes a moc of the foo.moc style gets the moc of the
+    // source itself, and no other file can change that. Those mocs are started right away while
+    // the pool of threads reads the headers, the loop below comes to the same result for them.
+    // The moc engine forks, which the threads of the pool don't survive, so it waits for them.
+    QHash<int, QString> startedMocs;  // key = source in paths, value = moc output filename
+    QList<ScanJob> headerScans = queueScans(scanHeaders, false);
+    QFuture<void> headersScanned = startScans(headerScans);
+    if (!inProcessMoc) {
+        foreach (const QString &absFilename, scanSources) {
+            const QString mocName = ownMocInclude(scanCache.value(absFilename));
+            if (mocName.isEmpty()) {
+                continue;
+            }
+            const int source = paths.insert(absFilename);
+            if (!startedMocs.contains(source)) {
+                startedMocs.insert(source, mocName);
+                generateMoc(absFilename, mocName, false);
+            }
+        }
+    }
+    headersScanned.waitForFinished();
+    recordScans(headerScans);
+
+    foreach (const QString &absFilename, sourceFiles) {
+        //qDebug() << absFilename;
+        const QFileInfo sourceFileInfo(absFilename);
+        if (isSourceFile(absFilename)) {
+            //qDebug() << "check .cpp file";
+            const ScanCacheEntry sourceScan = scanFile(absFilename, true);
+            if (sourceScan.size <= 0) {
+                cerr << "automoc4: empty source file: " << absFilename << endl;
+                continue;
+            }
+            const int sourceDir = paths.insertDir(sourceFileInfo.absolutePath());
+            if (sourceScan.mocIncludes.isEmpty()) {
+                // no moc #include, look whether we need to create a moc from the .h nevertheless
+                //qDebug() << "no moc #include in the .cpp file";
+                const QString basename = sourceFileInfo.completeBaseName();
+                foreach (const QString &ext, headerExtensions) {
+                    const int header = existingHeader(sourceDir, basename, "", ext);
+                    if (header >= 0 && !includedMocs.contains(header) &&
+                            !notIncludedMocs.contains(header)) {
+                        const QString currentMoc = "moc_" + basename + ".cpp";
+                        if (scanFile(paths.path(header), false).hasQObject) {
+                            //qDebug() << "header contains Q_OBJECT macro";
+                            notIncludedMocs.insert(header, currentMoc);
+                        }
+                        break;
+                    }
+                }
                 foreach (const QString &ext, headerExtensions) {
-                    const QString privateHeaderName = absPath + basename + "_p" + ext;
-                    if (QFile::exists(privateHeaderName) && !includedMocs.contains(privateHeaderName) &&
-                            !notIncludedMocs.contains(privateHeaderName)) {
+                    const int privateHeader = existingHeader(sourceDir, basename, "_p", ext);
+                    if (privateHeader >= 0 && !includedMocs.contains(privateHeader) &&
+                            !notIncludedMocs.contains(privateHeader)) {
                         const QString currentMoc = "moc_" + basename + "_p.cpp";
-                        QFile header(privateHeaderName);
-                        header.open(QIODevice::ReadOnly);
-                        const QByteArray contents = header.readAll();
-                        if (qObjectRegExp.indexIn(QString::fromUtf8(contents)) >= 0) {
+                        if (scanFile(paths.path(privateHeader), false).hasQObject) {
                             //qDebug() << "header contains Q_OBJECT macro";
-                            notIncludedMocs.insert(privateHeaderName, currentMoc);
+                            notIncludedMocs.insert(privateHeader, currentMoc);
                         }
                         break;
                     }
                 }
             } else {
-                do { // call this for every moc include in the file
-                    const QString currentMoc = mocIncludeRegExp.cap(1);
-                    //qDebug() << "found moc include: " << currentMoc << " at offset " << matchOffset;
-                    const QFileInfo currentMocInfo(currentMoc);
-                    QString basename = currentMocInfo.completeBaseName();
-                    const bool moc_style = basename.startsWith(QLatin1String("moc_"));
+                foreach (const QString &currentMoc, sourceScan.mocIncludes) {
+                    //qDebug() << "found moc include: " << currentMoc;
+                    const bool moc_style =
+                        QFileInfo(currentMoc).completeBaseName().startsWith(QLatin1String("moc_"));
 
                     // If the moc include is of the moc_foo.cpp style we expect the Q_OBJECT class
                     // declaration in a header file.
@@ -410,103 +1323,67 @@ bool AutoMoc::run()
                     //
                     // TODO: currently any .moc file name will be used if the source contains
                     // Q_OBJECT
-                    if (moc_style || qObjectRegExp.indexIn(contentsString) < 0) {
-                        if (moc_style) {
-                            // basename should be the part of the moc filename used for finding the
-                            // correct header, so we need to remove the moc_ part
-                            basename = basename.right(basename.length() - 4);
-                        }
-
-                        bool headerFound = false;
-                        foreach (const QString &ext, headerExtensions) {
-                            const QString &sourceFilePath = absPath + basename + ext;
-                            if (QFile::exists(sourceFilePath)) {
-                                headerFound = true;
-                                includedMocs.insert(sourceFilePath, currentMoc);
-                                notIncludedMocs.remove(sourceFilePath);
-                                break;
-                            }
-                        }
-                        if (!headerFound) {
-                            // the moc file is in a subdir => look for the header in the same subdir
-                            if (currentMoc.indexOf('/') != -1) {
-                                const QString &filepath = absPath + currentMocInfo.path() + QLatin1Char('/') + basename;
-
-                                foreach (const QString &ext, headerExtensions) {
-                                    const QString &sourceFilePath = filepath + ext;
-                                    if (QFile::exists(sourceFilePath)) {
-                                        headerFound = true;
-                                        includedMocs.insert(sourceFilePath, currentMoc);
-                                        notIncludedMocs.remove(sourceFilePath);
-                                        break;
-                                    }
-                                }
-                                if (!headerFound) {
-                                    cerr << "automoc4: The file \"" << absFilename <<
-                                        "\" includes the moc file \"" << currentMoc << "\", but neither \"" <<
-                                        absPath + basename + '{' + headerExtensions.join(",") + "}\" nor \"" <<
-                                        filepath + '{' + headerExtensions.join(",") + '}' <<
-                                        "\" exist." << endl;
-                                    ::exit(EXIT_FAILURE);
-                                }
-                            } else {
-                                cerr << "automoc4: The file \"" << absFilename <<
-                                    "\" includes the moc file \"" << currentMoc << "\", but \"" <<
-                                    absPath + basename + '{' + headerExtensions.join(",") + '}' <<
-                                    "\" does not exist." << endl;
-                                ::exit(EXIT_FAILURE);
-                            }
-                        }
+                    if (moc_style || !sourceScan.hasQObject) {
+                        const int header = includedMocHeader(absFilename, currentMoc, headerExtensions);
+                        includedMocs.insert(header, currentMoc);
+                        notIncludedMocs.remove(header);
                     } else {
-                        includedMocs.insert(absFilename, currentMoc);
-                        notIncludedMocs.remove(absFilename);
+                        const int source = paths.insert(absFilename);
+                        includedMocs.insert(source, currentMoc);
+                        notIncludedMocs.remove(source);
                     }
-
-                    matchOffset = mocIncludeRegExp.indexIn(contentsString,
-                            matchOffset + currentMoc.length());
-                } while(matchOffset >= 0);
+                }
             }
         } else if (absFilename.endsWith(QLatin1String(".h")) || absFilename.endsWith(QLatin1String(".hpp")) ||
                 absFilename.endsWith(QLatin1String(".hxx")) || absFilename.endsWith(QLatin1String(".H"))) {
-            if (!includedMocs.contains(absFilename) && !notIncludedMocs.contains(absFilename)) {
+            const int header = paths.insert(absFilename);
+            if (!includedMocs.contains(header) && !notIncludedMocs.contains(header)) {
                 // if this header is not getting processed yet and is explicitly mentioned for the
                 // automoc the moc is run unconditionally on the header and the resulting file is
                 // included in the _automoc.cpp file (unless there's a .cpp file later on that
                 // includes the moc from this header)
                 const QString currentMoc = "moc_" + sourceFileInfo.completeBaseName() + ".cpp";
-                notIncludedMocs.insert(absFilename, currentMoc);
+                notIncludedMocs.insert(header, currentMoc);
             }
         } else {
             if (verbose) {
-               cout << "automoc4: ignoring file '" << absFilename << "' with unknown suffix" << endl;
+               messages() << "automoc4: ignoring file '" << absFilename << "' with unknown suffix" << endl;
             }
         }
     }
 
+    beginPhase("moc");
+
     // run moc on all the moc's that are #included in source files
-    QHash<QString, QString>::ConstIterator end = includedMocs.constEnd();
-    QHash<QString, QString>::ConstIterator it = includedMocs.constBegin();
+    QHash<int, QString>::ConstIterator end = includedMocs.constEnd();
+    QHash<int, QString>::ConstIterator it = includedMocs.constBegin();
     for (; it != end; ++it) {
-        generateMoc(it.key(), it.value());
+        if (startedMocs.value(it.key()) != it.value()) {
+            generateMoc(paths.path(it.key()), it.value(), false);
+        }
     }
 
-    QByteArray automocSource;
-    QTextStream outStream(&automocSource, QIODevice::WriteOnly);
-    outStream << "/* This file is autogenerated, do not edit\n"
-        << mocDefinitions.join(QString(QLatin1Char(' '))) << "\n*/\n";
+    // run moc on the remaining headers, they get included in the _automoc.cpp files
+    end = notIncludedMocs.constEnd();
+    it = notIncludedMocs.constBegin();
+    for (; it != end; ++it) {
+        generateMoc(paths.path(it.key()), it.value(), true);
+    }
 
-    if (notIncludedMocs.isEmpty()) {
-        outStream << "enum some_compilers { need_more_than_nothing };\n";
-    } else {
-        // run moc on the remaining headers and include them in the _automoc.cpp file
-        end = notIncludedMocs.constEnd();
-        it = notIncludedMocs.constBegin();
-        for (; it != end; ++it) {
-            if (generateMoc(it.key(), it.value())) {
-                automocCppChanged = true;
-            }
-            outStream << "#include \"" << it.value() << "\"\n";
-        }
+    // wait for the moc processes still running in the job pool
+    waitForMocJobs(0);
+
+    if (!checkOnly) {
+        beginPhase("save scan cache");
+        saveScanCache();
+    }
+
+    beginPhase("write");
+
+    if (quiet && mocsGenerated > 0) {
+        echoColor(QString("Generated %1 moc files for %2").arg(mocsGenerated)
+                .arg(outfileInfo.fileName()));
+        cout << flush;
     }
 
     if (failed) {
@@ -515,107 +1392,1661 @@ bool AutoMoc::run()
         cerr << "returning failed.."<< endl;
         return false;
     }
-    outStream.flush();
 
-    if (!automocCppChanged) {
-        // compare contents of the _automoc.cpp file
-        outfile.open(QIODevice::ReadOnly | QIODevice::Text);
-        const QByteArray oldContents = outfile.readAll();
-        outfile.close();
-        if (oldContents == automocSource) {
-            // nothing changed: don't touch the _automoc.cpp file
-            return true;
+    // the first shard is the _automoc.cpp file itself
+    const QString definitions = QString::fromUtf8(definitionsComment(dotFiles));
+    const QList<QStringList> shards = shardMocs(outfileName, notIncludedMocs);
+    QString prefixHeader;
+    if (usePch) {
+        // foo_automoc.cpp gets foo_automoc_pch.h
+        prefixHeader = outfileName;
+        if (prefixHeader.endsWith(QLatin1String(".cpp"))) {
+            prefixHeader.chop(4);
+        }
+        prefixHeader += QLatin1String("_pch.h");
+        if (!writePrefixHeader(prefixHeader, shards)) {
+            return false;
         }
     }
-    // either the contents of the _automoc.cpp file or one of the mocs included by it have changed
+    QStringList shardNames;
+    QStringList unchangedFiles;
+    QString lastWritten;
+    for (int i = 0; i < shards.size(); ++i) {
+        const QString shardName = shardFileName(outfileName, i);
+        shardNames << shardName;
+
+        QByteArray automocSource;
+        QTextStream outStream(&automocSource, QIODevice::WriteOnly);
+        outStream << "/* This file is autogenerated, do not edit\n"
+            << definitions << "\n*/\n";
+        if (!prefixHeader.isEmpty()) {
+            // in the same directory
+            outStream << "#include \"" << QFileInfo(prefixHeader).fileName() << "\"\n";
+        }
+        bool mocChanged = false;
+        if (shards[i].isEmpty()) {
+            outStream << "enum some_compilers { need_more_than_nothing };\n";
+        }
+        foreach (const QString &mocFileName, shards[i]) {
+            outStream << "#include \"" << mocFileName << "\"\n";
+            mocChanged = mocChanged || changedMocs.contains(builddir + mocFileName);
+        }
+        outStream.flush();
+
+        QFile shardFile(shardName);
+        if (!mocChanged) {
+            // compare contents of the _automoc.cpp file
+            shardFile.open(QIODevice::ReadOnly | QIODevice::Text);
+            const QByteArray oldContents = shardFile.readAll();
+            shardFile.close();
+            if (oldContents == automocSource) {
+                // nothing changed: don't touch the _automoc.cpp file
+                unchangedFiles << shardName;
+                continue;
+            }
+        }
+        // either the contents of the _automoc.cpp file or one of the mocs included by it have changed
+        if (checkOnly) {
+            addToPlan(shardName, dotFiles.fileName(), shardFile.exists() ? "contents changed" : "missing");
+            continue;
+        }
 
-    // source file that includes all remaining moc files (_automoc.cpp file)
-    outfile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate);
-    outfile.write(automocSource);
-    outfile.close();
+        // source file that includes the remaining moc files of this shard
+        anythingChanged = true;
+        shardFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate);
+        shardFile.write(automocSource);
+        shardFile.close();
+        lastWritten = shardName;
+    }
 
     // update the timestamp on the _automoc.cpp.files file to make sure we get called again
     dotFiles.close();
-    if (doTouch && !touch(dotFiles.fileName())) {
+    if (checkOnly) {
+        return true;
+    }
+    if (doTouch && !lastWritten.isEmpty() && !touchNewerThan(dotFiles.fileName(), lastWritten)) {
         return false;
     }
 
-    return true;
+    QStringList outputs = shardNames;
+    if (!prefixHeader.isEmpty()) {
+        outputs << prefixHeader;
+    }
+    return updateDependencies(outputs, unchangedFiles);
 }
 
-bool AutoMoc::touch(const QString &_filename)
+QString AutoMoc::shardFileName(const QString &outfileName, int shard) const
 {
-    // sleep for 1s in order to make the modification time greater than the modification time of
-    // the files written before. Equal modification time is not good enough. Just using utime with
-    // time(NULL) + 1 is also not a good solution as then make will complain about clock skew.
-#ifdef Q_OS_WIN
-    Sleep(1000);
-    _wutime(reinterpret_cast<const wchar_t *>(_filename.utf16()), 0);
-#else
-    const QByteArray &filename = QFile::encodeName(_filename);
-    const struct timespec sleepDuration = { 1, 0 };
-    nanosleep(&sleepDuration, NULL);
+    if (shard == 0) {
+        return outfileName;
+    }
+    // foo_automoc.cpp, foo_automoc_1.cpp, foo_automoc_2.cpp, ...
+    QString base = outfileName;
+    if (base.endsWith(QLatin1String(".cpp"))) {
+        base.chop(4);
+    }
+    return base + QLatin1Char('_') + QString::number(shard) + QLatin1String(".cpp");
+}
 
-    int err = utime(filename.constData(), NULL);
-    if (err == -1) {
-        err = errno;
-        cerr << strerror(err) << "\n";
+bool AutoMoc::writePrefixHeader(const QString &fileName, const QList<QStringList> &shards)
+{
+    // the includes at the top of the mocs in the _automoc.cpp files, in the order they come
+    // there: the Qt headers and the header of the class. moc writes the latter relative to the
+    // moc file, the prefix header gets the absolute path. A header of the project in the prefix
+    // header would rebuild it and all the _automoc.cpp files whenever it changes, so only those
+    // shared by several mocs go there. QObject is needed by every moc. The moc of Qt 4 only
+    // includes the header of the class, so the Qt includes of that header are added as well.
+    QStringList includes;
+    QHash<QString, int> mocCounts;
+    includes << QLatin1String("<QtCore/qobject.h>");
+    mocCounts.insert(includes.first(), 1);
+    foreach (const QStringList &shard, shards) {
+        foreach (const QString &mocFileName, shard) {
+            QFile moc(builddir + mocFileName);
+            if (!moc.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                continue;
+            }
+            ++filesRead;
+            const QDir mocDir = QFileInfo(moc.fileName()).dir();
+            for (int i = 0; i < 64 && !moc.atEnd(); ++i) {
+                const QByteArray line = moc.readLine().trimmed();
+                if (line.startsWith("#if") || line.startsWith("QT_BEGIN_MOC_NAMESPACE")) {
+                    // the end of the includes
+                    break;
+                }
+                if (!line.startsWith("#include")) {
+                    continue;
+                }
+                QString include = QString::fromLocal8Bit(line.mid(8).trimmed());
+                QStringList mocIncludes;
+                if (include.size() > 2 && include.startsWith('"') && include.endsWith('"')) {
+                    const QString header = QDir::cleanPath(mocDir.absoluteFilePath(include.mid(1,
+                                    include.size() - 2)));
+                    include = '"' + header + '"';
+                    mocIncludes = qtIncludesOfHeader(header);
+                }
+                mocIncludes << include;
+                foreach (const QString &mocInclude, mocIncludes) {
+                    int &mocCount = mocCounts[mocInclude];
+                    if (mocCount == 0) {
+                        includes << mocInclude;
+                    }
+                    ++mocCount;
+                }
+            }
+        }
+    }
+
+    QString guard = QFileInfo(fileName).fileName().toUpper();
+    for (int i = 0; i < guard.size(); ++i) {
+        if (!guard[i].isLetterOrNumber()) {
+            guard[i] = QLatin1Char('_');
+        }
+    }
+    QByteArray contents;
+    QTextStream outStream(&contents, QIODevice::WriteOnly);
+    outStream << "/* This file is autogenerated, do not edit\n"
+        << "the includes of the mocs which are not included by a source, to be precompiled\n*/\n"
+        << "#ifndef " << guard << "\n#define " << guard << '\n';
+    foreach (const QString &include, includes) {
+        if (include.startsWith('<') || mocCounts.value(include) > 1) {
+            outStream << "#include " << include << '\n';
+        }
+    }
+    outStream << "#endif\n";
+    outStream.flush();
+
+    // a changed prefix header rebuilds the precompiled header and everything using it
+    QFile file(fileName);
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text) && file.readAll() == contents) {
+        return true;
+    }
+    file.close();
+    if (checkOnly) {
+        addToPlan(fileName, dotFiles.fileName(), file.exists() ? "contents changed" : "missing");
+        return true;
+    }
+    anythingChanged = true;
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate) ||
+            file.write(contents) != contents.size()) {
+        cerr << "automoc4: could not write " << fileName << endl;
         return false;
     }
-#endif
     return true;
 }
 
-bool AutoMoc::generateMoc(const QString &sourceFile, const QString &mocFileName)
+QStringList AutoMoc::qtIncludesOfHeader(const QString &header)
 {
-    //qDebug() << Q_FUNC_INFO << sourceFile << mocFileName;
-    const QString mocFilePath = builddir + mocFileName;
-    QFileInfo mocInfo(mocFilePath);
-    if (generateAll || mocInfo.lastModified() <= QFileInfo(sourceFile).lastModified()) {
-        QDir mocDir = mocInfo.dir();
-        // make sure the directory for the resulting moc file exists
-        if (!mocDir.exists()) {
-            mocDir.mkpath(mocDir.path());
+    // the <Q...> includes of the header outside of any #if but its include guard. The other
+    // includes of the header may depend on what the sources define before including it.
+    QStringList includes;
+    QFile file(header);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return includes;
+    }
+    ++filesRead;
+    int depth = 0;
+    for (int i = 0; i < 256 && !file.atEnd(); ++i) {
+        const QByteArray line = file.readLine().simplified();
+        if (line.startsWith("#if")) {
+            ++depth;
+        } else if (line.startsWith("#endif")) {
+            --depth;
+        } else if (depth <= 1 && line.startsWith("#include <Q") && line.endsWith('>')) {
+            includes << QString::fromLocal8Bit(line.mid(9));
         }
+    }
+    return includes;
+}
 
-        static bool initialized = false;
-        if (!initialized) {
-            initialized = true;
-            lazyInit();
+QList<QStringList> AutoMoc::shardMocs(const QString &outfileName,
+        const QHash<int, QString> &mocs) const
+{
+    // the compile time of a moc grows with its size. A moc moved to another shard rewrites and
+    // recompiles both, so the mocs stay in the shards the last run put them in, as read back from
+    // the shard files. Only new mocs are distributed, biggest first, each onto the shard with
+    // the least cost so far. Ties are broken by the names, so that the shards only depend on the
+    // mocs and their sizes and not on the hash order.
+    QHash<QString, int> previousShards;  // key = moc file name
+    if (shardCount > 1) {
+        for (int i = 0; i < shardCount; ++i) {
+            QFile shardFile(shardFileName(outfileName, i));
+            if (!shardFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                continue;
+            }
+            while (!shardFile.atEnd()) {
+                const QByteArray line = shardFile.readLine().trimmed();
+                // the include of the prefix header names no moc and is never looked up
+                if (line.startsWith("#include \"") && line.endsWith('"')) {
+                    const QByteArray mocFileName = line.mid(10, line.size() - 11);
+                    previousShards.insert(QString::fromLocal8Bit(mocFileName), i);
+                }
+            }
         }
-        if (verbose) {
-            echoColor("Generating " + mocFilePath + " from " + sourceFile);
-        } else {
-            echoColor("Generating " + mocFileName);
+    }
+
+    QList<QPair<qint64, QString> > costs;  // negative size, moc file name
+    QHash<int, QString>::ConstIterator it = mocs.constBegin();
+    for (; it != mocs.constEnd(); ++it) {
+        const QFileInfo mocInfo(builddir + it.value());
+        const qint64 cost = mocInfo.exists() ? mocInfo.size() : QFileInfo(paths.path(it.key())).size();
+        costs << qMakePair(-cost, it.value());
+    }
+    qSort(costs);
+
+    QList<QStringList> shards;
+    QList<qint64> shardCosts;
+    for (int i = 0; i < shardCount; ++i) {
+        shards << QStringList();
+        shardCosts << 0;
+    }
+    qint64 totalCost = 0;
+    QList<QPair<qint64, QString> > newMocs;
+    for (int i = 0; i < costs.size(); ++i) {
+        totalCost -= costs[i].first;
+        const int shard = previousShards.value(costs[i].second, -1);
+        if (shard < 0) {
+            newMocs << costs[i];
+            continue;
+        }
+        shards[shard] << costs[i].second;
+        shardCosts[shard] -= costs[i].first;
+    }
+    for (int i = 0; i < shardCount; ++i) {
+        // grown far beyond its share, the whole distribution starts over
+        if (costs.size() > shardCount && shardCosts[i] > 2 * totalCost / shardCount) {
+            for (int j = 0; j < shardCount; ++j) {
+                shards[j].clear();
+                shardCosts[j] = 0;
+            }
+            newMocs = costs;
+            break;
+        }
+    }
+    for (int i = 0; i < newMocs.size(); ++i) {
+        int cheapest = 0;
+        for (int shard = 1; shard < shardCount; ++shard) {
+            if (shardCosts[shard] < shardCosts[cheapest]) {
+                cheapest = shard;
+            }
         }
+        shards[cheapest] << newMocs[i].second;
+        shardCosts[cheapest] -= newMocs[i].first;
+    }
+    for (int i = 0; i < shardCount; ++i) {
+        shards[i].sort();
+    }
+    return shards;
+}
 
-        QProcess mocProc;
-        mocProc.setProcessChannelMode(QProcess::ForwardedChannels);
-        QStringList args(mocIncludes + mocDefinitions);
+static DirectoryListing readDirectory(const QString &dir)
+{
+    DirectoryListing listing;
 #ifdef Q_OS_WIN
-        args << "-DWIN32";
+    // not case sensitive
+    listing.caseSensitive = false;
+    QDir directory(dir);
+    if (!directory.exists()) {
+        return listing;
+    }
+    foreach (const QString &name, directory.entryList(QDir::AllEntries | QDir::Hidden |
+                QDir::System | QDir::NoDotAndDotDot)) {
+        listing.names.insert(name.toLower());
+    }
+    listing.complete = true;
+#else
+    const QByteArray encodedDir = QFile::encodeName(dir.isEmpty() ? QString(QLatin1Char('/')) : dir);
+#if defined(Q_OS_DARWIN) || defined(Q_OS_MAC)
+    // detect case-sensitive filesystem
+    listing.caseSensitive = (pathconf(encodedDir.constData(), _PC_CASE_SENSITIVE) == 1);
 #endif
-        args << QLatin1String("-o") << mocFilePath << sourceFile;
-        //qDebug() << "executing: " << mocExe << args;
-        if (verbose) {
-            cout << mocExe << " " << args.join(QLatin1String(" ")) << endl;
-        }
-        mocProc.start(mocExe, args, QIODevice::NotOpen);
-        if (mocProc.waitForStarted()) {
-            const bool result = mocProc.waitForFinished(-1);
-            if (!result || mocProc.exitCode()) {
-                cerr << "automoc4: process for " << mocFilePath
-                     << " failed: " << mocProc.errorString() << endl;
-                cerr << "pid to wait for: " << mocProc.pid() << endl;
-                failed = true;
-                QFile::remove(mocFilePath);
-            }
-            return true;
-        } else {
-            cerr << "automoc4: process for " << mocFilePath << "failed to start: " 
-                 << mocProc.errorString() << endl;
-            failed = true;
-        }
+    DIR *directory = opendir(encodedDir.constData());
+    if (!directory) {
+        // a missing directory has no files, one that can't be listed may still have some
+        listing.complete = (errno == ENOENT || errno == ENOTDIR);
+        return listing;
     }
-    return false;
+    while (const struct dirent *entry = readdir(directory)) {
+        const QString name = QFile::decodeName(entry->d_name);
+        listing.names.insert(listing.caseSensitive ? name : name.toLower());
+    }
+    closedir(directory);
+    listing.complete = true;
+#endif
+    return listing;
+}
+
+bool AutoMoc::nameExists(const QString &dir, const QString &name)
+{
+    // every directory is read only once, a stat for every candidate header is expensive on
+    // network filesystems
+    QHash<QString, DirectoryListing>::ConstIterator it = dirListings.constFind(dir);
+    if (it == dirListings.constEnd()) {
+        it = dirListings.insert(dir, readDirectory(dir));
+        ++directoriesRead;
+    }
+    ++existenceChecks;
+
+    if (it->complete) {
+        return it->names.contains(it->caseSensitive ? name : name.toLower());
+    }
+    ++statCalls;
+    return QFile::exists(dir + QLatin1Char('/') + name);
 }
+
+int AutoMoc::existingHeader(int dir, const QString &baseName, const char *suffix, const QString &ext)
+{
+    // returns the id of <dir>/<baseName><suffix><ext> in paths if the file exists, -1 otherwise.
+    // The name is put together in a buffer that keeps its capacity, the lookups don't allocate
+    // and only a header that exists is added to the table.
+    candidateName.resize(0);
+    candidateName += baseName;
+    candidateName += QLatin1String(suffix);
+    candidateName += ext;
+    const QString &dirPath = paths.dirPath(dir);
+    if (!nameExists(dirPath, candidateName)) {
+        // a header that is missing now may be created later, its directory changes then
+        dirDependencies.insert(dir);
+        return -1;
+    }
+    const int id = paths.insert(dir, candidateName);
+    headerDependencies.insert(id);
+    return id;
+}
+
+int AutoMoc::includedMocHeader(const QString &absFilename, const QString &mocInclude,
+        const QStringList &headerExtensions)
+{
+    // the header the moc included by the source as mocInclude is generated from: next to the
+    // source, or in the subdir of the moc include. Exits if there is none.
+    const QFileInfo sourceFileInfo(absFilename);
+    const QString absPath = sourceFileInfo.absolutePath() + '/';
+    const QFileInfo mocInfo(mocInclude);
+    QString basename = mocInfo.completeBaseName();
+    if (basename.startsWith(QLatin1String("moc_"))) {
+        // basename should be the part of the moc filename used for finding the correct header,
+        // so we need to remove the moc_ part
+        basename = basename.right(basename.length() - 4);
+    }
+
+    const int sourceDir = paths.insertDir(sourceFileInfo.absolutePath());
+    foreach (const QString &ext, headerExtensions) {
+        const int header = existingHeader(sourceDir, basename, "", ext);
+        if (header >= 0) {
+            return header;
+        }
+    }
+
+    const QString headerExtensionList = '{' + headerExtensions.join(",") + '}';
+    if (mocInclude.indexOf('/') == -1) {
+        cerr << "automoc4: The file \"" << absFilename <<
+            "\" includes the moc file \"" << mocInclude << "\", but \"" <<
+            absPath + basename + headerExtensionList <<
+            "\" does not exist." << endl;
+        fatal();
+        return -1;
+    }
+
+    // the moc file is in a subdir => look for the header in the same subdir
+    QString subdir = absPath + mocInfo.path();
+    if (subdir.contains(QLatin1String("/."))) {
+        subdir = QDir::cleanPath(subdir);
+    }
+    const int mocDir = paths.insertDir(subdir);
+    foreach (const QString &ext, headerExtensions) {
+        const int header = existingHeader(mocDir, basename, "", ext);
+        if (header >= 0) {
+            return header;
+        }
+    }
+    cerr << "automoc4: The file \"" << absFilename <<
+        "\" includes the moc file \"" << mocInclude << "\", but neither \"" <<
+        absPath + basename + headerExtensionList + "\" nor \"" <<
+        subdir + '/' + basename + headerExtensionList <<
+        "\" exist." << endl;
+    fatal();
+    return -1;
+}
+
+static QByteArray escapeDependency(const QString &path)
+{
+    // what make and ninja expect in a depfile
+    QByteArray escaped = QFile::encodeName(path);
+    escaped.replace('$', "$$");
+    escaped.replace('#', "\\#");
+    escaped.replace(' ', "\\ ");
+    return escaped;
+}
+
+bool AutoMoc::updateDependencies(const QStringList &outputs, const QStringList &unchangedFiles)
+{
+    if (depFile.isEmpty()) {
+        return true;
+    }
+    foreach (int id, headerDependencies) {
+        dependencies.insert(paths.path(id));
+    }
+    foreach (int dir, dirDependencies) {
+        dependencies.insert(paths.dirPath(dir));
+    }
+    if (!batchFile.isEmpty()) {
+        batchDependencies += dependencies;
+        batchOutputs += outputs;
+        batchUnchangedFiles += unchangedFiles;
+        return true;
+    }
+    return writeDependencies(dependencies, outputs, unchangedFiles);
+}
+
+bool AutoMoc::writeDependencies(const QSet<QString> &allDependencies, const QStringList &outputs,
+        const QStringList &unchangedFiles)
+{
+    if (depFile.isEmpty() || (stampFile.isEmpty() && outputs.isEmpty())) {
+        return true;
+    }
+
+    // like gcc -MD -MP: the target with all its dependencies, and an empty rule for every
+    // dependency, so that a removed file doesn't stop the build but reruns automoc4
+    QStringList sortedDependencies = allDependencies.toList();
+    // the files written by automoc4 itself are outputs or byproducts of the command, as
+    // dependencies they would make it depend on itself
+    foreach (const QString &output, outputs) {
+        sortedDependencies.removeAll(output);
+    }
+    sortedDependencies.sort();
+    QByteArray contents = escapeDependency(stampFile.isEmpty() ? outputs.first() : stampFile) + ':';
+    foreach (const QString &dependency, sortedDependencies) {
+        contents += " \\\n  " + escapeDependency(dependency);
+    }
+    contents += '\n';
+    foreach (const QString &dependency, sortedDependencies) {
+        contents += '\n' + escapeDependency(dependency) + ":\n";
+    }
+    QFile file(depFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(contents) != contents.size()) {
+        cerr << "automoc4: could not write " << depFile << endl;
+        return false;
+    }
+    file.close();
+
+    // the target of the depfile has to be newer than everything looked at, which includes the
+    // mocs written by this run
+    if (!stampFile.isEmpty()) {
+        QFile stamp(stampFile);
+        if (!stamp.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            cerr << "automoc4: could not write " << stampFile << endl;
+            return false;
+        }
+        return true;
+    }
+    foreach (const QString &unchanged, unchangedFiles) {
+        if (!touch(unchanged)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static qint64 modificationTime(const QString &filename)
+{
+    // in nanoseconds, the second resolution of QFileInfo::lastModified is too coarse
+#ifdef Q_OS_WIN
+    const QDateTime lastModified = QFileInfo(filename).lastModified();
+    return (qint64(lastModified.toTime_t()) * 1000 + lastModified.time().msec()) * 1000000;
+#else
+    struct stat info;
+    if (stat(QFile::encodeName(filename).constData(), &info) != 0) {
+        return -1;
+    }
+#if defined(Q_OS_DARWIN) || defined(Q_OS_MAC)
+    return qint64(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    return qint64(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
+bool AutoMoc::touchNewerThan(const QString &filename, const QString &reference)
+{
+    // equal modification times are not good enough for make. Just using utime with time(NULL) + 1
+    // is not a good solution as then make will complain about clock skew. With the sub-second
+    // timestamps of current filesystems the file is newer right away, on filesystems with coarse
+    // timestamps wait for the clock to move on, but not longer than needed.
+    const qint64 referenceTime = modificationTime(reference);
+    for (int i = 0; i < 300; ++i) {
+        if (!touch(filename)) {
+            return false;
+        }
+        if (modificationTime(filename) > referenceTime) {
+            return true;
+        }
+#ifdef Q_OS_WIN
+        Sleep(10);
+#else
+        const struct timespec sleepDuration = { 0, 10000000 };
+        nanosleep(&sleepDuration, NULL);
+#endif
+    }
+    return true;
+}
+
+bool AutoMoc::touch(const QString &_filename)
+{
+#ifdef Q_OS_WIN
+    _wutime(reinterpret_cast<const wchar_t *>(_filename.utf16()), 0);
+#else
+    const QByteArray &filename = QFile::encodeName(_filename);
+    int err = utime(filename.constData(), NULL);
+    if (err == -1) {
+        err = errno;
+        cerr << strerror(err) << "\n";
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool AutoMoc::generateMoc(const QString &sourceFile, const QString &mocFileName, bool inAutomocCpp)
+{
+    //qDebug() << Q_FUNC_INFO << sourceFile << mocFileName;
+    const QString mocFilePath = builddir + mocFileName;
+    dependencies.insert(sourceFile);
+    dependencies.insert(mocFilePath);
+    QFileInfo mocInfo(mocFilePath);
+    ++statCalls;
+
+    if (mocCommandHash.isEmpty()) {
+        // the fingerprint of the manifest stands for the arguments, they are then only put
+        // together when a moc has to be generated
+        const QByteArray manifestFingerprint = dotFiles.fingerprint();
+        mocCommandHash = QCryptographicHash::hash(mocExeIdentity() + '\n' +
+                (manifestFingerprint.isEmpty() ? mocArguments().join(QLatin1String("\n")).toUtf8() :
+                 "automoc4 " AUTOMOC4_VERSION " " + manifestFingerprint), QCryptographicHash::Md5);
+    }
+
+    // a moc is generated again exactly when the moc executable, its arguments or the contents
+    // of its input changed since it was generated last time, or when it is missing
+    const QHash<QString, MocFingerprint>::ConstIterator previous = mocFingerprints.constFind(mocFilePath);
+    MocFingerprint fingerprint;
+    fingerprint.commandHash = mocCommandHash;
+    const bool inputRead = hashInput(sourceFile,
+            previous != mocFingerprints.constEnd() ? &previous.value() : 0, &fingerprint);
+    const bool upToDate = inputRead && mocInfo.exists() && previous != mocFingerprints.constEnd() &&
+        previous->commandHash == fingerprint.commandHash &&
+        previous->inputHash == fingerprint.inputHash;
+    if (!upToDate && checkOnly) {
+        // the same decision as below, only reported
+        const char *reason = !mocInfo.exists() ? "missing" :
+            previous == mocFingerprints.constEnd() ? "new" :
+            !inputRead ? "source unreadable" :
+            previous->commandHash != fingerprint.commandHash ? "arguments changed" : "source changed";
+        addToPlan(mocFilePath, sourceFile, reason);
+        return false;
+    }
+    if (!upToDate) {
+        QDir mocDir = mocInfo.dir();
+        // make sure the directory for the resulting moc file exists
+        if (!mocDir.exists()) {
+            mocDir.mkpath(mocDir.path());
+        }
+
+        const QString tempFilePath = mocFilePath + QLatin1String(".automoc4-tmp");
+        QStringList args = mocArguments();
+        args << QLatin1String("-o") << tempFilePath << sourceFile;
+
+        // the messages are printed together with the output of moc when the job is finished
+        MocJob *job = new MocJob;
+        job->sourceFile = sourceFile;
+        job->mocFilePath = mocFilePath;
+        job->tempFilePath = tempFilePath;
+        job->fingerprint = fingerprint;
+        job->inAutomocCpp = inAutomocCpp;
+        job->message = verbose ? "Generating " + mocFilePath + " from " + sourceFile :
+            "Generating " + mocFileName;
+        if (!mocCacheDir.isEmpty() && inputRead) {
+            job->cacheEntry = mocCacheEntry(sourceFile, mocFilePath, fingerprint);
+            job->startUsecs = AutoMocTrace::now();
+            if (fetchFromMocCache(job->cacheEntry, tempFilePath)) {
+                if (trace.isEnabled()) {
+                    trace.complete(QFileInfo(mocFilePath).fileName(), "moc cache", job->startUsecs,
+                            AutoMocTrace::now(), 0, AutoMocTrace::arg("source", sourceFile) +
+                            AutoMocTrace::arg("cache_entry", job->cacheEntry));
+                }
+                // queued like a finished moc process, so the messages stay in order
+                job->commandLine = "copied from " + job->cacheEntry;
+                job->process = 0;
+                job->started = true;
+                job->slot = -1;
+                mocJobs.enqueue(job);
+                return true;
+            }
+        }
+
+        // wait for a free slot in the job pool
+        waitForMocSlot();
+
+        job->startUsecs = AutoMocTrace::now();
+        job->slot = 0;
+        while (busyMocSlots.contains(job->slot)) {
+            ++job->slot;
+        }
+        busyMocSlots.insert(job->slot);
+        if (verbose) {
+            job->commandLine = mocExe + ' ' + args.join(QLatin1String(" "));
+        }
+        //qDebug() << "executing: " << mocExe << args;
+        job->process = new MocProcess;
+        job->started = false;
+#ifdef AUTOMOC4_MOC_ENGINE
+        if (inProcessMoc) {
+            // the child only needs the input and output, the engine keeps the other arguments
+            MocEngine::setArguments(args.mid(0, args.size() - 3));
+            job->started = job->process->startEngine(sourceFile, tempFilePath);
+            if (job->started && verbose) {
+                job->commandLine = "moc engine: " + args.join(QLatin1String(" "));
+            }
+        }
+#endif
+        if (!job->started) {
+            // moc itself is also the fallback if the engine can't fork
+            job->started = job->process->start(mocExe, args);
+        }
+        mocJobs.enqueue(job);
+        return job->started;
+    }
+    newMocFingerprints.insert(mocFilePath, fingerprint);
+    return false;
+}
+
+QByteArray AutoMoc::mocExeIdentity()
+{
+    if (inProcessMoc) {
+        // the engine changes with automoc4 and with the moc sources it was built from
+        return QByteArray("automoc4 " AUTOMOC4_VERSION " moc engine " AUTOMOC4_MOC_ENGINE_REVISION);
+    }
+    // a rebuilt or updated moc has a different size or modification time
+    const QHash<QString, QByteArray>::ConstIterator cached = mocExeIdentities.constFind(mocExe);
+    if (cached != mocExeIdentities.constEnd()) {
+        return cached.value();
+    }
+    ++statCalls;
+    const QFileInfo info(mocExe);
+    QByteArray identity = QFile::encodeName(mocExe);
+    if (info.exists()) {
+        identity += ' ' + QByteArray::number(info.size()) + ' ' +
+            QByteArray::number(info.lastModified().toTime_t());
+    }
+    mocExeIdentities.insert(mocExe, identity);
+    return identity;
+}
+
+bool AutoMoc::hashInput(const QString &inputFile, const MocFingerprint *previous,
+        MocFingerprint *fingerprint)
+{
+    ++statCalls;
+    const QFileInfo info(inputFile);
+    fingerprint->inputSize = info.size();
+    fingerprint->inputMtime = info.exists() ? info.lastModified().toTime_t() : 0;
+
+    // sources were hashed by the scan already
+    const QHash<QString, ScanCacheEntry>::ConstIterator scanned = scanCache.constFind(inputFile);
+    if (scanned != scanCache.constEnd() && !scanned->hash.isEmpty() &&
+            scanned->size == fingerprint->inputSize && scanned->mtime == fingerprint->inputMtime) {
+        fingerprint->inputHash = scanned->hash;
+        return true;
+    }
+    // headers are only read again if they changed, the same rules as for the scan cache apply
+    if (previous && previous->inputSize == fingerprint->inputSize &&
+            previous->inputMtime == fingerprint->inputMtime && fingerprint->inputMtime < lastScanTime) {
+        fingerprint->inputHash = previous->inputHash;
+        return true;
+    }
+
+    QFile file(inputFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    ++filesRead;
+    const qint64 size = file.size();
+    uchar *mapped = size > 0 ? file.map(0, size) : 0;
+    if (mapped) {
+        fingerprint->inputHash = QCryptographicHash::hash(QByteArray::fromRawData(
+                    reinterpret_cast<const char *>(mapped), size), QCryptographicHash::Md5);
+        file.unmap(mapped);
+    } else {
+        fingerprint->inputHash = QCryptographicHash::hash(file.readAll(), QCryptographicHash::Md5);
+    }
+    bytesRead += size;
+    return true;
+}
+
+// renames from to to, replacing to if it exists
+static bool replaceFile(const QString &from, const QString &to)
+{
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<const wchar_t *>(from.utf16()),
+            reinterpret_cast<const wchar_t *>(to.utf16()), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return ::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+QString AutoMoc::mocCacheEntry(const QString &sourceFile, const QString &mocFilePath,
+        const MocFingerprint &fingerprint) const
+{
+    // moc writes the path of its input relative to the output into the #include line, so build
+    // directories share entries if they are at the same place relative to the sources
+    const QString relativeSource = QFileInfo(mocFilePath).dir().relativeFilePath(sourceFile);
+    const QByteArray key = QCryptographicHash::hash(fingerprint.commandHash + '\n' +
+            fingerprint.inputHash + '\n' + relativeSource.toUtf8(), QCryptographicHash::Md5).toHex();
+    // spread over 256 directories, like ccache does it
+    return mocCacheDir + QLatin1Char('/') + QString::fromLatin1(key.left(2)) + QLatin1Char('/') +
+        QString::fromLatin1(key.mid(2)) + QLatin1String(".moc");
+}
+
+static bool markUsed(const QString &filePath)
+{
+    // the modification time of a cache entry is the time it was used last
+#ifdef Q_OS_WIN
+    return _wutime(reinterpret_cast<const wchar_t *>(filePath.utf16()), 0) == 0;
+#else
+    return utime(QFile::encodeName(filePath).constData(), NULL) == 0;
+#endif
+}
+
+bool AutoMoc::fetchFromMocCache(const QString &cacheEntry, const QString &filePath)
+{
+    // entries are copied and not hardlinked: a hardlinked moc would share its modification
+    // time with the entry and with the same moc in all other build directories, so make
+    // would not rebuild what includes it, or rebuild it in the other build directories
+    QFile::remove(filePath);
+    if (!QFile::copy(cacheEntry, filePath)) {
+        // an entry that was evicted by another automoc4 process in the meantime is just a miss
+        return false;
+    }
+    ++filesRead;
+    markUsed(cacheEntry);
+    return true;
+}
+
+void AutoMoc::storeInMocCache(const QString &filePath, const QString &cacheEntry)
+{
+    // readers must never see a half written entry, and automoc4 processes of other build
+    // directories may store the same entry at the same time, the last rename wins
+    const QString dir = QFileInfo(cacheEntry).path();
+    if (!QDir().mkpath(dir)) {
+        return;
+    }
+    const QString tempEntry = cacheEntry + QLatin1String(".tmp") +
+        QString::number(QCoreApplication::applicationPid());
+    QFile::remove(tempEntry);
+    if (!QFile::copy(filePath, tempEntry) || !replaceFile(tempEntry, cacheEntry)) {
+        QFile::remove(tempEntry);
+        return;
+    }
+    trimMocCache(dir);
+}
+
+void AutoMoc::trimMocCache(const QString &dir)
+{
+    // every one of the 256 directories gets its share of the size limit, so only the directory
+    // that just grew has to be looked at. The least recently used entries are removed until it
+    // is at 90% of its share, concurrent processes may remove a bit more, which does no harm.
+    const qint64 limit = mocCacheSize / 256;
+    const QFileInfoList entries = QDir(dir).entryInfoList(QStringList(QLatin1String("*.moc")),
+            QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    foreach (const QFileInfo &entry, entries) {
+        total += entry.size();
+    }
+    if (total <= limit) {
+        return;
+    }
+    foreach (const QFileInfo &entry, entries) {
+        if (total <= limit * 9 / 10) {
+            break;
+        }
+        if (QFile::remove(entry.filePath())) {
+            total -= entry.size();
+        }
+    }
+}
+
+int AutoMoc::collectMocJobs()
+{
+    // returns the number of moc processes still running
+    int running = 0;
+    foreach (MocJob *job, mocJobs) {
+        if (job->process && job->process->isRunning()) {
+            ++running;
+        }
+    }
+
+    // collect the finished jobs in the order they were started, so that the output does not
+    // depend on which moc process happens to exit first
+    while (!mocJobs.isEmpty() && (!mocJobs.head()->process ||
+                !mocJobs.head()->process->isRunning())) {
+        finishMocJob(mocJobs.dequeue());
+    }
+
+    // every running moc but one holds a token of the jobserver, the others go back to make right
+    // away, a job finished in the middle of the queue doesn't have to wait for the ones before it
+    while (jobServer.tokens() > qMax(running - 1, 0)) {
+        jobServer.release();
+    }
+    return running;
+}
+
+void AutoMoc::waitForMocJobs(int maxRunning)
+{
+    forever {
+        if (collectMocJobs() <= maxRunning) {
+            return;
+        }
+
+        // block on the oldest job that is still running for a moment and check again
+        foreach (MocJob *job, mocJobs) {
+            if (job->process && job->process->isRunning()) {
+                job->process->waitForFinished(20);
+                break;
+            }
+        }
+    }
+}
+
+void AutoMoc::waitForMocSlot()
+{
+    if (!jobServer.isConnected()) {
+        waitForMocJobs(maxMocJobs - 1);
+        return;
+    }
+    // the first moc runs on the job make started automoc4 with, every further one needs a token.
+    // -j of automoc4 still limits the mocs of this process.
+    forever {
+        const int running = collectMocJobs();
+        if (running == 0 || (running < maxMocJobs && jobServer.tryAcquire())) {
+            return;
+        }
+
+        // wait for a token or for the oldest running moc, whichever comes first
+        if (running < maxMocJobs) {
+            jobServer.waitForToken(10);
+            if (jobServer.tryAcquire()) {
+                return;
+            }
+        }
+        foreach (MocJob *job, mocJobs) {
+            if (job->process && job->process->isRunning()) {
+                job->process->waitForFinished(10);
+                break;
+            }
+        }
+    }
+}
+
+void AutoMoc::finishMocJob(MocJob *job)
+{
+    // the output of moc was buffered, write it in one go so that lines of different jobs don't mix
+    ++mocsGenerated;
+    const qint64 end = AutoMocTrace::now();
+    if (!job->process) {
+        ++mocCacheHits;
+    } else {
+        ++mocProcesses;
+        mocProcessTime += end - job->startUsecs;
+        busyMocSlots.remove(job->slot);
+    }
+    if (job->process && trace.isEnabled()) {
+        // the lanes of the moc processes come after the main one
+        trace.threadName(job->slot + 1, QString("moc %1").arg(job->slot + 1));
+        trace.complete(QFileInfo(job->mocFilePath).fileName(), "moc", job->startUsecs, end,
+                job->slot + 1, AutoMocTrace::arg("source", job->sourceFile) +
+                AutoMocTrace::arg("started", job->started) +
+                AutoMocTrace::arg("crashed", job->started && job->process->crashed()) +
+                AutoMocTrace::arg("exit_code", job->started ? job->process->exitCode() : -1));
+    }
+    if (!quiet) {
+        echoColor(job->message);
+        if (verbose) {
+            cout << job->commandLine << '\n';
+        }
+    }
+    cout << flush;
+
+    if (!job->started) {
+        cerr << "automoc4: process for " << job->mocFilePath << " failed to start: "
+             << job->process->errorString() << endl;
+        failed = true;
+        ++mocFailures;
+        delete job->process;
+        delete job;
+        return;
+    }
+
+    if (job->process) {
+        const QByteArray stdoutData = job->process->readAllStandardOutput();
+        if (!stdoutData.isEmpty()) {
+            cout << QString::fromLocal8Bit(stdoutData) << flush;
+        }
+        const QByteArray stderrData = job->process->readAllStandardError();
+        if (!stderrData.isEmpty()) {
+            cerr << QString::fromLocal8Bit(stderrData) << flush;
+        }
+    }
+
+    const bool mocFailed = job->process && (job->process->crashed() || job->process->exitCode());
+    if (job->process && !mocFailed && !job->cacheEntry.isEmpty()) {
+        storeInMocCache(job->tempFilePath, job->cacheEntry);
+    }
+
+    bool changed = false;
+    if (mocFailed) {
+        cerr << "automoc4: process for " << job->mocFilePath
+             << " failed: " << job->process->errorString() << endl;
+        failed = true;
+        ++mocFailures;
+        QFile::remove(job->tempFilePath);
+        QFile::remove(job->mocFilePath);
+    } else if (!replaceIfDifferent(job->tempFilePath, job->mocFilePath, &changed)) {
+        cerr << "automoc4: could not replace " << job->mocFilePath << endl;
+        failed = true;
+        QFile::remove(job->tempFilePath);
+        QFile::remove(job->mocFilePath);
+    } else if (changed) {
+        anythingChanged = true;
+        if (job->inAutomocCpp) {
+            changedMocs.insert(job->mocFilePath);
+        }
+    }
+
+    // the input was hashed before moc was started, if it changes while moc runs it gets
+    // hashed again next time because its timestamp isn't older than the start of this run
+    ++statCalls;
+    if (QFile::exists(job->mocFilePath)) {
+        newMocFingerprints.insert(job->mocFilePath, job->fingerprint);
+    }
+
+    delete job->process;
+    delete job;
+}
+
+// moc of Qt 4 writes the time it was run into the header comment, this must not count as a change
+static QByteArray withoutCreatedLine(const QByteArray &mocOutput)
+{
+    const int start = mocOutput.indexOf("\n** Created: ");
+    if (start < 0) {
+        return mocOutput;
+    }
+    int end = mocOutput.indexOf('\n', start + 1);
+    if (end < 0) {
+        end = mocOutput.size();
+    }
+    QByteArray result(mocOutput);
+    result.remove(start, end - start);
+    return result;
+}
+
+bool AutoMoc::replaceIfDifferent(const QString &tempFilePath, const QString &filePath, bool *changed)
+{
+    *changed = false;
+    QFile newFile(tempFilePath);
+    QFile oldFile(filePath);
+    if (newFile.open(QIODevice::ReadOnly) && oldFile.open(QIODevice::ReadOnly)) {
+        const bool same = withoutCreatedLine(newFile.readAll()) == withoutCreatedLine(oldFile.readAll());
+        newFile.close();
+        oldFile.close();
+        if (same) {
+            // keep the old file and its timestamp, so nothing including it gets recompiled
+            QFile::remove(tempFilePath);
+            return true;
+        }
+    }
+    newFile.close();
+
+    // replace the old file in one step, nothing ever sees a half written moc file
+    const bool renamed = replaceFile(tempFilePath, filePath);
+    *changed = renamed;
+    return renamed;
+}
+
+void AutoMoc::loadScanCache()
+{
+    scanTime = QDateTime::currentDateTime().toTime_t();
+    if (!scanCacheFile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QDataStream stream(&scanCacheFile);
+    stream.setVersion(QDataStream::Qt_4_0);
+    QByteArray magic;
+    quint32 version;
+    stream >> magic >> version;
+    if (magic == "automoc4 scan cache" && version == 4) {
+        stream >> lastScanTime >> scanCache >> mocFingerprints;
+    }
+    if (stream.status() != QDataStream::Ok) {
+        // ignore a truncated or otherwise broken cache, everything gets scanned again
+        lastScanTime = 0;
+        scanCache.clear();
+        mocFingerprints.clear();
+    }
+    scanCacheFile.close();
+}
+
+void AutoMoc::saveScanCache()
+{
+    // only keep the files which were looked at in this run, so the cache doesn't grow forever
+    if (!scanCacheChanged && scannedFiles.size() == scanCache.size() &&
+            newMocFingerprints == mocFingerprints) {
+        return;
+    }
+    QHash<QString, ScanCacheEntry> entries;
+    foreach (const QString &absFilename, scannedFiles) {
+        entries.insert(absFilename, scanCache.value(absFilename));
+    }
+    if (!scanCacheFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (verbose) {
+            cerr << "automoc4: could not write " << scanCacheFile.fileName() << endl;
+        }
+        return;
+    }
+    QDataStream stream(&scanCacheFile);
+    stream.setVersion(QDataStream::Qt_4_0);
+    stream << QByteArray("automoc4 scan cache") << quint32(4) << scanTime << entries
+        << newMocFingerprints;
+    scanCacheFile.close();
+}
+
+static qint64 updateScanEntry(ScanCacheEntry &entry, const QString &absFilename, bool scanIncludes,
+        qint64 lastScanTime)
+{
+    // returns the number of bytes read, -1 if the entry was still valid. It runs in the threads
+    // of AutoMoc::prescanFiles, so it must not touch anything but the entry.
+    const bool complete = entry.includesScanned || !scanIncludes;
+
+    // a file modified in the same second as the last scan may have changed after it was read,
+    // so its size and mtime are not good enough and the contents have to be compared
+    const QFileInfo info(absFilename);
+    const qint64 mtime = info.exists() ? info.lastModified().toTime_t() : 0;
+    if (complete && entry.size == info.size() && entry.mtime == mtime && mtime < lastScanTime) {
+        return -1;
+    }
+
+    QFile file(absFilename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        entry = ScanCacheEntry();
+        entry.size = 0;
+        entry.mtime = mtime;
+        entry.includesScanned = scanIncludes;
+        return 0;
+    }
+
+    if (!scanIncludes) {
+        // for a header the only question is whether it contains a Q_OBJECT or Q_GADGET, so
+        // reading stops at the first one. A mapped file only gets paged in up to that point.
+        entry = ScanCacheEntry();
+        entry.size = file.size();
+        entry.mtime = mtime;
+        uchar *mapped = entry.size > 0 ? file.map(0, entry.size) : 0;
+        if (mapped) {
+            entry.hasQObject = MocScanner::containsQObject(reinterpret_cast<const char *>(mapped),
+                    entry.size);
+            file.unmap(mapped);
+        } else {
+            entry.hasQObject = MocScanner::containsQObject(&file);
+        }
+        return entry.size;
+    }
+
+    // the complete list of moc includes is needed for a source file, so it is read completely
+    const qint64 size = file.size();
+    uchar *mapped = size > 0 ? file.map(0, size) : 0;
+    QByteArray contents;
+    if (mapped) {
+        contents = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+    } else {
+        contents = file.readAll();
+    }
+
+    const QByteArray hash = QCryptographicHash::hash(contents, QCryptographicHash::Md5);
+    if (complete && entry.size == contents.size() && entry.hash == hash) {
+        // only the timestamp changed
+        entry.mtime = mtime;
+    } else {
+        entry = ScanCacheEntry();
+        entry.size = contents.size();
+        entry.mtime = mtime;
+        entry.hash = hash;
+        entry.includesScanned = true;
+        entry.hasQObject = MocScanner::scanSource(contents.constData(), contents.size(),
+                &entry.mocIncludes);
+    }
+
+    if (mapped) {
+        contents.clear();
+        file.unmap(mapped);
+    }
+    return size;
+}
+
+ScanCacheEntry AutoMoc::scanFile(const QString &absFilename, bool scanIncludes)
+{
+    ScanCacheEntry &entry = scanCache[absFilename];
+    const bool complete = entry.includesScanned || !scanIncludes;
+    if (scannedFiles.contains(absFilename) && complete) {
+        return entry;
+    }
+    scannedFiles.insert(absFilename);
+
+    // another target of a batch run already looked at this file
+    const QHash<QString, ScanCacheEntry>::ConstIterator shared = sharedScans.constFind(absFilename);
+    if (shared != sharedScans.constEnd() && (shared->includesScanned || !scanIncludes)) {
+        ++scanCacheHits;
+        if (entry.size != shared->size || entry.mtime != shared->mtime ||
+                entry.includesScanned != shared->includesScanned) {
+            scanCacheChanged = true;
+        }
+        entry = shared.value();
+        return entry;
+    }
+
+    const qint64 start = AutoMocTrace::now();
+    const qint64 bytes = updateScanEntry(entry, absFilename, scanIncludes, lastScanTime);
+    recordScan(absFilename, entry, bytes, start, AutoMocTrace::now(), 0);
+    return entry;
+}
+
+void AutoMoc::recordScan(const QString &absFilename, const ScanCacheEntry &entry, qint64 bytes,
+        qint64 start, qint64 end, int lane)
+{
+    ++statCalls;
+    if (bytes < 0) {
+        ++scanCacheHits;
+    } else {
+        scanCacheChanged = true;
+        ++filesRead;
+        bytesRead += bytes;
+        qObjectMatches += entry.hasQObject ? 1 : 0;
+        mocIncludeMatches += entry.mocIncludes.size();
+        if (trace.isEnabled()) {
+            trace.complete(QFileInfo(absFilename).fileName(), "scan", start, end, lane,
+                    AutoMocTrace::arg("file", absFilename) + AutoMocTrace::arg("bytes", bytes) +
+                    AutoMocTrace::arg("q_object", entry.hasQObject) +
+                    AutoMocTrace::arg("moc_includes", entry.mocIncludes.size()));
+        }
+    }
+    sharedScans.insert(absFilename, entry);
+}
+
+static void runScanJob(ScanJob &job)
+{
+    job.start = AutoMocTrace::now();
+    job.bytes = updateScanEntry(job.entry, job.fileName, job.scanIncludes, job.lastScanTime);
+    job.end = AutoMocTrace::now();
+}
+
+void AutoMoc::prescanFiles(const QStringList &files, bool scanIncludes)
+{
+    // scans the files scanFile would not answer without reading them, in parallel
+    QList<ScanJob> jobs = queueScans(files, scanIncludes);
+    if (jobs.size() == 1) {
+        runScanJob(jobs.first());
+    } else if (jobs.size() > 1) {
+        startScans(jobs).waitForFinished();
+    }
+    recordScans(jobs);
+}
+
+QFuture<void> AutoMoc::startScans(QList<ScanJob> &jobs)
+{
+    // the threads mostly wait for the filesystem, so there are as many as moc jobs
+    QThreadPool::globalInstance()->setMaxThreadCount(maxMocJobs);
+    return QtConcurrent::map(jobs, runScanJob);
+}
+
+QList<ScanJob> AutoMoc::queueScans(const QStringList &files, bool scanIncludes)
+{
+    // the files scanFile would not answer without reading them
+    QList<ScanJob> jobs;
+    QSet<QString> queued;
+    foreach (const QString &absFilename, files) {
+        const ScanCacheEntry &entry = scanCache[absFilename];
+        if (queued.contains(absFilename) ||
+                (scannedFiles.contains(absFilename) && (entry.includesScanned || !scanIncludes))) {
+            continue;
+        }
+        const QHash<QString, ScanCacheEntry>::ConstIterator shared = sharedScans.constFind(absFilename);
+        if (shared != sharedScans.constEnd() && (shared->includesScanned || !scanIncludes)) {
+            continue;
+        }
+        queued.insert(absFilename);
+        ScanJob job;
+        job.fileName = absFilename;
+        job.scanIncludes = scanIncludes;
+        job.lastScanTime = lastScanTime;
+        job.entry = entry;
+        jobs << job;
+    }
+    return jobs;
+}
+
+void AutoMoc::recordScans(const QList<ScanJob> &jobs)
+{
+    // trace lanes for the threads, after the ones of the moc processes
+    QList<int> lanes;
+    if (trace.isEnabled()) {
+        QList<QPair<qint64, int> > starts;
+        for (int i = 0; i < jobs.size(); ++i) {
+            starts << qMakePair(jobs[i].start, i);
+            lanes << 0;
+        }
+        qSort(starts);
+        QList<qint64> laneEnds;
+        for (int i = 0; i < starts.size(); ++i) {
+            const ScanJob &job = jobs[starts[i].second];
+            int lane = 0;
+            while (lane < laneEnds.size() && laneEnds[lane] > job.start) {
+                ++lane;
+            }
+            if (lane == laneEnds.size()) {
+                laneEnds << job.end;
+                trace.threadName(1000 + lane, QString("scan %1").arg(lane + 1));
+            } else {
+                laneEnds[lane] = job.end;
+            }
+            lanes[starts[i].second] = 1000 + lane;
+        }
+    }
+
+    for (int i = 0; i < jobs.size(); ++i) {
+        const ScanJob &job = jobs[i];
+        scanCache[job.fileName] = job.entry;
+        scannedFiles.insert(job.fileName);
+        recordScan(job.fileName, job.entry, job.bytes, job.start, job.end,
+                lanes.isEmpty() ? 0 : lanes[i]);
+    }
+}
+
+#ifdef Q_OS_LINUX
+static bool writeAll(int fd, const char *data, int size)
+{
+    while (size > 0) {
+        const ssize_t written = ::write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char *data, int size)
+{
+    while (size > 0) {
+        const ssize_t bytesRead = ::read(fd, data, size);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        data += bytesRead;
+        size -= bytesRead;
+    }
+    return true;
+}
+
+// messages between client and server are a 32 bit big endian length followed by the data
+static bool sendMessage(int fd, const QByteArray &message)
+{
+    const quint32 size = message.size();
+    const char header[4] = { char(size >> 24), char(size >> 16), char(size >> 8), char(size) };
+    return writeAll(fd, header, 4) && writeAll(fd, message.constData(), message.size());
+}
+
+static bool receiveMessage(int fd, QByteArray *message)
+{
+    unsigned char header[4];
+    if (!readAll(fd, reinterpret_cast<char *>(header), 4)) {
+        return false;
+    }
+    const quint32 size = (quint32(header[0]) << 24) | (quint32(header[1]) << 16) |
+        (quint32(header[2]) << 8) | quint32(header[3]);
+    message->resize(size);
+    return readAll(fd, message->data(), size);
+}
+
+static bool socketAddress(const QString &path, struct sockaddr_un *address)
+{
+    const QByteArray encoded = QFile::encodeName(path);
+    if (encoded.size() >= int(sizeof(address->sun_path))) {
+        return false;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path, encoded.constData(), encoded.size());
+    return true;
+}
+
+bool AutoMoc::runClient(bool *result)
+{
+    struct sockaddr_un address;
+    if (!socketAddress(clientSocket, &address)) {
+        return false;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // the server doesn't share our environment, send what depends on it along with the arguments
+    QByteArray request;
+    QDataStream requestStream(&request, QIODevice::WriteOnly);
+    requestStream.setVersion(QDataStream::Qt_4_0);
+    requestStream << QCoreApplication::arguments() << useColor << verbose << qgetenv("MAKEFLAGS");
+
+    QByteArray reply;
+    const bool ok = sendMessage(fd, request) && receiveMessage(fd, &reply);
+    ::close(fd);
+    if (!ok) {
+        return false;
+    }
+
+    QDataStream replyStream(reply);
+    replyStream.setVersion(QDataStream::Qt_4_0);
+    qint32 exitCode;
+    bool changed;
+    QString out;
+    QString err;
+    replyStream >> exitCode >> changed >> out >> err;
+    if (replyStream.status() != QDataStream::Ok) {
+        return false;
+    }
+    cout << out << flush;
+    cerr << err << flush;
+    if (verbose) {
+        messages() << "automoc4: " << (changed ? "updated by the server" : "up to date") << endl;
+    }
+    // 2 is the exit code of --check for outputs that would be regenerated
+    *result = (exitCode == 0 || exitCode == 2);
+    stale = (exitCode == 2);
+    return true;
+}
+
+bool AutoMoc::runServer()
+{
+    struct sockaddr_un address;
+    if (!socketAddress(serverSocket, &address)) {
+        cerr << "automoc4: socket path too long: " << serverSocket << endl;
+        return false;
+    }
+    // moc processes must not inherit the sockets, clients would wait for them otherwise
+    const int serverFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::unlink(address.sun_path);
+    if (serverFd < 0 || ::bind(serverFd, reinterpret_cast<struct sockaddr *>(&address),
+                sizeof(address)) != 0 || ::listen(serverFd, 16) != 0) {
+        cerr << "automoc4: could not listen on " << serverSocket << ": " << strerror(errno) << endl;
+        return false;
+    }
+    inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        cerr << "automoc4: inotify is not available: " << strerror(errno) << endl;
+        return false;
+    }
+    serverMode = true;
+    stdoutFile.open(stdout, QIODevice::WriteOnly);
+    stderrFile.open(stderr, QIODevice::WriteOnly);
+
+    forever {
+        struct pollfd fds[2];
+        fds[0].fd = serverFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = inotifyFd;
+        fds[1].events = POLLIN;
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "automoc4: poll failed: " << strerror(errno) << endl;
+            return false;
+        }
+        if (fds[1].revents & POLLIN) {
+            processWatchEvents();
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        const int fd = ::accept4(serverFd, 0, 0, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        QByteArray request;
+        if (!receiveMessage(fd, &request)) {
+            ::close(fd);
+            continue;
+        }
+        QDataStream requestStream(request);
+        requestStream.setVersion(QDataStream::Qt_4_0);
+        QStringList requestArgs;
+        QByteArray makeFlags;
+        requestStream >> requestArgs >> useColor >> verbose >> makeFlags;
+        struct ucred client;
+        socklen_t clientSize = sizeof(client);
+        if (requestStream.status() != QDataStream::Ok || requestArgs.isEmpty() ||
+                ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &client, &clientSize) != 0) {
+            ::close(fd);
+            continue;
+        }
+
+        // files changed right before the request was sent must be seen by it, and moc may
+        // have been rebuilt since the last request
+        processWatchEvents();
+        mocExeIdentities.clear();
+
+        // options of the previous request must not leak into this one
+        quiet = false;
+        doTouch = false;
+        depFile.clear();
+        stampFile.clear();
+        stats = false;
+        shardCount = 1;
+        usePch = false;
+        traceFile.clear();
+        batchFile.clear();
+        maxMocJobs = defaultMocJobs();
+        mocCacheDir = defaultMocCacheDir();
+        mocCacheSize = defaultMocCacheSize();
+        inProcessMoc = false;
+        checkOnly = false;
+        planFile.clear();
+        plan.clear();
+        stale = false;
+        anythingChanged = false;
+
+        QString out;
+        QString err;
+        cout.setString(&out);
+        cerr.setString(&err);
+        const qint64 requestTime = QDateTime::currentDateTime().toTime_t();
+        bool result = false;
+        try {
+            const QStringList positional = parseOptions(requestArgs);
+            // the mocs of the request count against the -j of the make that sent it
+            connectJobServer(makeFlags, client.pid);
+            trace.setEnabled(!traceFile.isEmpty());
+            result = runArguments(positional);
+        } catch (const FatalError &) {
+            abortMocJobs();
+            result = false;
+        }
+        jobServer.disconnect();
+        writeTrace();
+        writePlan();
+        cout.flush();
+        cerr.flush();
+        watchScannedFiles(requestTime);
+
+        QByteArray reply;
+        QDataStream replyStream(&reply, QIODevice::WriteOnly);
+        replyStream.setVersion(QDataStream::Qt_4_0);
+        replyStream << qint32(!result ? 1 : stale ? 2 : 0) << anythingChanged << out << err;
+        sendMessage(fd, reply);
+        ::close(fd);
+        // out and err go away with this iteration
+        cout.setDevice(&stdoutFile);
+        cerr.setDevice(&stderrFile);
+    }
+}
+
+bool AutoMoc::watchDirectory(const QString &dir)
+{
+    if (watchedDirNames.contains(dir)) {
+        return true;
+    }
+    const int wd = inotify_add_watch(inotifyFd, QFile::encodeName(dir).constData(),
+            IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+            IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) {
+        return false;
+    }
+    watchedDirs.insert(wd, dir);
+    watchedDirNames.insert(dir);
+    return true;
+}
+
+void AutoMoc::watchScannedFiles(qint64 requestTime)
+{
+    // watching the directories is enough to hear about changed, new and removed files in them.
+    // Whatever can't be watched must be looked at again every time.
+    QSet<QString> newDirs;
+    QMutableHashIterator<QString, ScanCacheEntry> it(sharedScans);
+    while (it.hasNext()) {
+        it.next();
+        const QString dir = it.key().left(it.key().lastIndexOf(QLatin1Char('/')));
+        if (!watchedDirNames.contains(dir)) {
+            newDirs.insert(dir);
+        }
+        if (!watchDirectory(dir)) {
+            it.remove();
+        }
+    }
+    QMutableHashIterator<QString, DirectoryListing> listingIt(dirListings);
+    while (listingIt.hasNext()) {
+        const QString &dir = listingIt.next().key();
+        if (!watchedDirNames.contains(dir)) {
+            newDirs.insert(dir);
+        }
+        if (!watchDirectory(dir)) {
+            listingIt.remove();
+        }
+    }
+    if (newDirs.isEmpty()) {
+        return;
+    }
+
+    // a file in a directory which was not watched yet may have changed after it was scanned
+    // and before the watch was added. Those are checked again, and the ones modified in the
+    // same second as the request may have changed without a visible change of the mtime.
+    it.toFront();
+    while (it.hasNext()) {
+        it.next();
+        if (!newDirs.contains(it.key().left(it.key().lastIndexOf(QLatin1Char('/'))))) {
+            continue;
+        }
+        const QFileInfo info(it.key());
+        const qint64 mtime = info.exists() ? info.lastModified().toTime_t() : 0;
+        if (it.value().size != info.size() || it.value().mtime != mtime || mtime >= requestTime) {
+            it.remove();
+        }
+    }
+    listingIt.toFront();
+    while (listingIt.hasNext()) {
+        const QString &dir = listingIt.next().key();
+        if (newDirs.contains(dir) && QFileInfo(dir).lastModified().toTime_t() >= requestTime) {
+            listingIt.remove();
+        }
+    }
+}
+
+void AutoMoc::processWatchEvents()
+{
+    char buffer[16384] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    forever {
+        struct pollfd fds;
+        fds.fd = inotifyFd;
+        fds.events = POLLIN;
+        if (::poll(&fds, 1, 0) <= 0) {
+            return;
+        }
+        const ssize_t size = ::read(inotifyFd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            return;
+        }
+        for (const char *pos = buffer; pos < buffer + size; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(pos);
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost, nothing is known anymore
+                sharedScans.clear();
+                dirListings.clear();
+                continue;
+            }
+            const QString dir = watchedDirs.value(event->wd);
+            if (dir.isEmpty()) {
+                continue;
+            }
+            if (event->len > 0) {
+                sharedScans.remove(dir + QLatin1Char('/') + QFile::decodeName(event->name));
+                dirListings.remove(dir);
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                dirListings.remove(dir);
+                const QString prefix = dir + QLatin1Char('/');
+                QMutableHashIterator<QString, ScanCacheEntry> it(sharedScans);
+                while (it.hasNext()) {
+                    if (it.next().key().startsWith(prefix)) {
+                        it.remove();
+                    }
+                }
+                if (event->mask & IN_IGNORED) {
+                    watchedDirs.remove(event->wd);
+                    watchedDirNames.remove(dir);
+                }
+            }
+        }
+    }
+}
+#else
+bool AutoMoc::watchDirectory(const QString &)
+{
+    return false;
+}
+
+bool AutoMoc::runClient(bool *)
+{
+    return false;
+}
+
+bool AutoMoc::runServer()
+{
+    cerr << "automoc4: --server is only supported on Linux" << endl;
+    return false;
+}
+
+void AutoMoc::watchScannedFiles(qint64)
+{
+}
+
+void AutoMoc::processWatchEvents()
+{
+}
+#endif
@@ -0,0 +1,185 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "manifest.h"
+
+#include <QtCore/QList>
+
+// the names of the sections in the index and in the line based format
+static const char *const sectionNames[Manifest::SectionCount] = {
+    "sources",
+    "compile_definitions",
+    "definitions",
+    "includes",
+    "project_before",
+    "binary_dir",
+    "source_dir"
+};
+static const char *const sectionLabels[Manifest::SectionCount] = {
+    "SOURCES:",
+    "MOC_COMPILE_DEFINITIONS:",
+    "MOC_DEFINITIONS:",
+    "MOC_INCLUDES:",
+    "CMAKE_INCLUDE_DIRECTORIES_PROJECT_BEFORE:",
+    "CMAKE_BINARY_DIR:",
+    "CMAKE_SOURCE_DIR:"
+};
+
+Manifest::Manifest()
+    : mapped(0)
+{
+    close();
+}
+
+Manifest::~Manifest()
+{
+    close();
+}
+
+bool Manifest::open(const QString &fileName)
+{
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    mapped = size > 0 ? file.map(0, size) : 0;
+    if (mapped) {
+        contents = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+    } else {
+        contents = file.readAll();
+    }
+    if (contents.startsWith("automoc4 manifest ")) {
+        return parseIndex();
+    }
+    return parseLines();
+}
+
+void Manifest::close()
+{
+    contents.clear();
+    if (mapped) {
+        file.unmap(mapped);
+        mapped = 0;
+    }
+    file.close();
+    hash.clear();
+    for (int i = 0; i < SectionCount; ++i) {
+        offsets[i] = 0;
+        lengths[i] = 0;
+    }
+}
+
+QByteArray Manifest::section(Section section) const
+{
+    // a copy, the mapping goes away with close()
+    return QByteArray(contents.constData() + offsets[section], lengths[section]);
+}
+
+bool Manifest::readLine(int *pos, QByteArray *line) const
+{
+    // the line without the newline, and without the carriage return of files edited on Windows
+    if (*pos >= contents.size()) {
+        return false;
+    }
+    int end = contents.indexOf('\n', *pos);
+    if (end < 0) {
+        end = contents.size();
+    }
+    int length = end - *pos;
+    if (length > 0 && contents.at(end - 1) == '\r') {
+        --length;
+    }
+    *line = QByteArray::fromRawData(contents.constData() + *pos, length);
+    *pos = end + 1;
+    return true;
+}
+
+bool Manifest::parseIndex()
+{
+    int pos = 0;
+    QByteArray line;
+    if (!readLine(&pos, &line) || line != "automoc4 manifest 1") {
+        // a newer Automoc4Config.cmake than this automoc4
+        return false;
+    }
+    bool found[SectionCount] = { false, false, false, false, false, false, false };
+    while (readLine(&pos, &line) && line != "end") {
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.size() == 2 && fields[0] == "fingerprint") {
+            hash = fields[1];
+            continue;
+        }
+        if (fields.size() != 3) {
+            return false;
+        }
+        for (int i = 0; i < SectionCount; ++i) {
+            if (fields[0] == sectionNames[i]) {
+                bool offsetOk = false;
+                bool lengthOk = false;
+                offsets[i] = fields[1].toInt(&offsetOk);
+                lengths[i] = fields[2].toInt(&lengthOk);
+                if (!offsetOk || !lengthOk || offsets[i] < 0 || lengths[i] < 0) {
+                    return false;
+                }
+                found[i] = true;
+            }
+        }
+        // sections unknown to this version are skipped
+    }
+    if (line != "end" || hash.isEmpty()) {
+        return false;
+    }
+    for (int i = 0; i < SectionCount; ++i) {
+        if (!found[i] || offsets[i] + lengths[i] > contents.size() - pos) {
+            return false;
+        }
+        offsets[i] += pos;
+    }
+    return true;
+}
+
+bool Manifest::parseLines()
+{
+    // a label line followed by the section in one line. The directories are only needed if the
+    // project directories come first, so they may be missing.
+    int pos = 0;
+    QByteArray line;
+    for (int i = 0; i < SectionCount; ++i) {
+        if (!readLine(&pos, &line)) {
+            return i >= BinaryDir;
+        }
+        if (line != sectionLabels[i]) {
+            return false;
+        }
+        offsets[i] = pos;
+        if (!readLine(&pos, &line)) {
+            return false;
+        }
+        lengths[i] = line.size();
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+
+// The <outfile>.files file written by Automoc4Config.cmake. Its current format starts with an
+// index: a fingerprint of everything the moc arguments are made of, and the offset and length
+// of every section relative to the end of the index, followed by the sections themselves:
+//
+//   automoc4 manifest 1
+//   fingerprint <md5 in hex>
+//   sources <offset> <length>
+//   ...
+//   end
+//   <every section followed by a newline>
+//
+// The file is mapped and a section is only copied when it is asked for. The line based format
+// of earlier versions, a "SOURCES:" line followed by the sources and so on, is still read.
+class Manifest
+{
+    public:
+        enum Section {
+            Sources,
+            CompileDefinitions,
+            Definitions,
+            Includes,
+            ProjectBefore,
+            BinaryDir,
+            SourceDir,
+            SectionCount
+        };
+
+        Manifest();
+        ~Manifest();
+
+        // false if the file can't be read or is not a manifest
+        bool open(const QString &fileName);
+        void close();
+        QString fileName() const { return file.fileName(); }
+
+        // empty if the manifest doesn't have the section
+        QByteArray section(Section section) const;
+        // empty for the line based format, the caller has to look at the sections then
+        QByteArray fingerprint() const { return hash; }
+
+    private:
+        bool readLine(int *pos, QByteArray *line) const;
+        bool parseIndex();
+        bool parseLines();
+
+        QFile file;
+        uchar *mapped;
+        QByteArray contents;  // the mapped file, or a copy if it can't be mapped
+        int offsets[SectionCount];
+        int lengths[SectionCount];
+        QByteArray hash;
+};
+
+#endif // MANIFEST_H
@@ -0,0 +1,329 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "mocengine.h"
+
+// from the moc sources
+#include "moc.h"
+#include "preprocessor.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void exitChild()
+{
+    // moc calls exit() on errors. In the child that would run the static destructors of automoc4,
+    // which must only run in automoc4 itself.
+    fflush(0);
+    ::_exit(EXIT_FAILURE);
+}
+
+// parsed by setArguments in automoc4, inherited by the children
+static QList<Preprocessor::IncludePath> includePaths;
+static Macros definedMacros;
+
+// the path of the input as the #include line in the output, as in main.cpp of moc
+static QByteArray combinePath(const QByteArray &infile, const QByteArray &outfile)
+{
+    QFileInfo inFileInfo(QDir::current(), QFile::decodeName(infile));
+    QFileInfo outFileInfo(QDir::current(), QFile::decodeName(outfile));
+    int numCommonComponents = 0;
+
+    QStringList inSplitted = inFileInfo.dir().canonicalPath().split(QLatin1Char('/'));
+    QStringList outSplitted = outFileInfo.dir().canonicalPath().split(QLatin1Char('/'));
+
+    while (!inSplitted.isEmpty() && !outSplitted.isEmpty() &&
+            inSplitted.first() == outSplitted.first()) {
+        inSplitted.removeFirst();
+        outSplitted.removeFirst();
+        numCommonComponents++;
+    }
+
+    if (numCommonComponents < 2) {
+        // the paths don't have the same drive, or they don't have the same root directory
+        return QFile::encodeName(inFileInfo.absoluteFilePath());
+    }
+
+    while (!outSplitted.isEmpty()) {
+        outSplitted.removeFirst();
+        inSplitted.prepend(QLatin1String(".."));
+    }
+    inSplitted.append(inFileInfo.fileName());
+    return QFile::encodeName(inSplitted.join(QLatin1String("/")));
+}
+
+// what "moc <args> -o <output> <filename>" does, see runMoc in main.cpp of moc
+static int runMoc(const QByteArray &filename, const QByteArray &output)
+{
+    Preprocessor pp;
+    Moc moc;
+    pp.macros = definedMacros;
+    pp.includes = includePaths;
+
+    const int spos = filename.lastIndexOf('/');
+    const int ppos = filename.lastIndexOf('.');
+    moc.noInclude = (ppos > spos && tolower(filename[ppos + 1]) != 'h');
+    moc.includeFiles.append(combinePath(filename, output));
+
+    QFile in(QFile::decodeName(filename));
+    if (!in.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "moc: %s: No such file\n", filename.constData());
+        return 1;
+    }
+    moc.filename = filename;
+    moc.currentFilenames.push(filename);
+
+    moc.symbols = pp.preprocessed(moc.filename, &in);
+    moc.parse();
+
+    FILE *out = fopen(output.constData(), "w");
+    if (!out) {
+        fprintf(stderr, "moc: Cannot create %s\n", output.constData());
+        return 1;
+    }
+    if (moc.classList.isEmpty()) {
+        moc.warning("No relevant classes found. No output generated.");
+    } else {
+        moc.generate(out);
+    }
+    fclose(out);
+    return 0;
+}
+
+void MocEngine::setArguments(const QStringList &args)
+{
+    // the same for all the mocs of a target
+    static QStringList currentArgs;
+    if (args == currentArgs && !definedMacros.isEmpty()) {
+        return;
+    }
+    currentArgs = args;
+    includePaths.clear();
+    definedMacros.clear();
+    definedMacros["Q_MOC_RUN"];
+    definedMacros["__cplusplus"];
+    for (int i = 0; i < args.size(); ++i) {
+        const QString &arg = args[i];
+        if (arg.startsWith(QLatin1String("-I")) || arg.startsWith(QLatin1String("-F"))) {
+            QByteArray path = QFile::encodeName(arg.mid(2));
+            if (path.isEmpty() && i + 1 < args.size()) {
+                path = QFile::encodeName(args[++i]);
+            }
+            Preprocessor::IncludePath includePath(path);
+            includePath.isFrameworkPath = arg.startsWith(QLatin1String("-F"));
+            includePaths += includePath;
+        } else if (arg.startsWith(QLatin1String("-D"))) {
+            QByteArray name = arg.mid(2).toLocal8Bit();
+            QByteArray value("1");
+            const int eq = name.indexOf('=');
+            if (eq >= 0) {
+                value = name.mid(eq + 1);
+                name = name.left(eq);
+            }
+            if (!name.isEmpty()) {
+                Macro macro;
+                macro.symbols += Symbol(0, PP_IDENTIFIER, value);
+                definedMacros.insert(name, macro);
+            }
+        }
+    }
+}
+
+MocEngine::MocEngine()
+    : pid(-1), outputFd(-1), errorFd(-1), finished(false), crash(false), code(0)
+{
+}
+
+MocEngine::~MocEngine()
+{
+    if (pid > 0 && !finished) {
+        kill();
+    }
+}
+
+static bool createPipe(int fds[2])
+{
+    // moc processes started with QProcess must not inherit the read ends
+    if (::pipe(fds) != 0) {
+        return false;
+    }
+    ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+bool MocEngine::start(const QString &inputFile, const QString &outputFile)
+{
+    int outputPipe[2];
+    int errorPipe[2];
+    if (!createPipe(outputPipe)) {
+        error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+    if (!createPipe(errorPipe)) {
+        error = QString::fromLocal8Bit(strerror(errno));
+        ::close(outputPipe[0]);
+        ::close(outputPipe[1]);
+        return false;
+    }
+    const QByteArray input = QFile::encodeName(inputFile);
+    const QByteArray output = QFile::encodeName(outputFile);
+
+    // buffered output of automoc4 would be written by the child again
+    fflush(0);
+    pid = ::fork();
+    if (pid == 0) {
+        ::atexit(exitChild);
+        ::dup2(outputPipe[1], STDOUT_FILENO);
+        ::dup2(errorPipe[1], STDERR_FILENO);
+        const int result = runMoc(input, output);
+        fflush(0);
+        ::_exit(result);
+    }
+    ::close(outputPipe[1]);
+    ::close(errorPipe[1]);
+    if (pid < 0) {
+        error = QString::fromLocal8Bit(strerror(errno));
+        ::close(outputPipe[0]);
+        ::close(errorPipe[0]);
+        return false;
+    }
+    outputFd = outputPipe[0];
+    errorFd = errorPipe[0];
+    return true;
+}
+
+QByteArray MocEngine::takeOutput(QByteArray *output)
+{
+    const QByteArray result = *output;
+    output->clear();
+    return result;
+}
+
+void MocEngine::readOutput(int msecs)
+{
+    // waits up to msecs for output, then reads everything that is there
+    forever {
+        struct pollfd fds[2];
+        int *fdFields[2];
+        QByteArray *buffers[2];
+        int count = 0;
+        if (outputFd >= 0) {
+            fds[count].fd = outputFd;
+            fds[count].events = POLLIN;
+            fdFields[count] = &outputFd;
+            buffers[count++] = &standardOutput;
+        }
+        if (errorFd >= 0) {
+            fds[count].fd = errorFd;
+            fds[count].events = POLLIN;
+            fdFields[count] = &errorFd;
+            buffers[count++] = &standardError;
+        }
+        if (count == 0 || ::poll(fds, count, msecs) <= 0) {
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            char buffer[4096];
+            const ssize_t n = ::read(fds[i].fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                buffers[i]->append(buffer, n);
+            } else if (n == 0 || errno != EINTR) {
+                ::close(fds[i].fd);
+                *fdFields[i] = -1;
+            }
+        }
+        msecs = 0;
+    }
+}
+
+void MocEngine::reap()
+{
+    // the child closes its output only when it exits
+    if (finished || pid <= 0 || outputFd >= 0 || errorFd >= 0) {
+        return;
+    }
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    finished = true;
+    crash = !WIFEXITED(status);
+    code = crash ? -1 : WEXITSTATUS(status);
+    if (crash) {
+        error = QLatin1String("moc crashed");
+    } else if (code != 0) {
+        error = QString("moc exited with code %1").arg(code);
+    }
+}
+
+bool MocEngine::isRunning()
+{
+    if (pid <= 0) {
+        return false;
+    }
+    readOutput(0);
+    reap();
+    return !finished;
+}
+
+bool MocEngine::waitForFinished(int msecs)
+{
+    if (pid <= 0) {
+        return true;
+    }
+    if (msecs < 0) {
+        while (!finished) {
+            readOutput(-1);
+            reap();
+        }
+    } else {
+        readOutput(msecs);
+        reap();
+    }
+    return finished;
+}
+
+void MocEngine::kill()
+{
+    if (pid > 0 && !finished) {
+        ::kill(pid, SIGKILL);
+        waitForFinished(-1);
+    }
+}
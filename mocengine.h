@@ -0,0 +1,76 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MOCENGINE_H
+#define MOCENGINE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include <sys/types.h>
+
+// moc's preprocessor, parser and generator, built into automoc4 from the moc sources of Qt 4.8
+// when AUTOMOC4_MOC_SOURCE_DIR is set. Every moc runs in a forked child without exec: moc exits
+// on errors and keeps the included files in static members, neither may affect automoc4 or the
+// next moc. The child inherits the include paths and definitions, which are parsed only once
+// for all the mocs of a target. The interface is the part of QProcess automoc4 uses.
+class MocEngine
+{
+    public:
+        MocEngine();
+        ~MocEngine();
+
+        // the moc arguments (-I, -F, -D, other options are ignored) of the following runs
+        static void setArguments(const QStringList &args);
+
+        bool start(const QString &inputFile, const QString &outputFile);
+        bool isRunning();
+        bool waitForFinished(int msecs);
+        void kill();
+
+        bool crashed() const { return crash; }
+        int exitCode() const { return code; }
+        QByteArray readAllStandardOutput() { return takeOutput(&standardOutput); }
+        QByteArray readAllStandardError() { return takeOutput(&standardError); }
+        QString errorString() const { return error; }
+
+    private:
+        static QByteArray takeOutput(QByteArray *output);
+        void readOutput(int msecs);
+        void reap();
+
+        pid_t pid;
+        int outputFd;
+        int errorFd;
+        bool finished;
+        bool crash;
+        int code;
+        QByteArray standardOutput;
+        QByteArray standardError;
+        QString error;
+};
+
+#endif // MOCENGINE_H
@@ -0,0 +1,422 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "mocscanner.h"
+
+#include <QtCore/QIODevice>
+
+#include <string.h>
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline bool isWordChar(char c)
+{
+    const unsigned char u = static_cast<unsigned char>(c);
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') ||
+        u == '_' || u >= 0x80;
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool endsWith(const char *begin, const char *end, const char *suffix, int suffixLength)
+{
+    return end - begin >= suffixLength && memcmp(end - suffixLength, suffix, suffixLength) == 0;
+}
+
+static bool equals(const char *begin, const char *end, const char *word)
+{
+    const int length = strlen(word);
+    return end - begin == length && memcmp(begin, word, length) == 0;
+}
+
+// checks the file name of an include against ((?:[^ ">]+/)?moc_[^ ">/]+\.cpp|[^ ">]+\.moc)
+static bool isMocFileName(const char *begin, const char *end)
+{
+    if (end - begin > 4 && endsWith(begin, end, ".moc", 4)) {
+        return true;
+    }
+    if (!endsWith(begin, end, ".cpp", 4)) {
+        return false;
+    }
+    const char *fileName = end;
+    while (fileName > begin && fileName[-1] != '/') {
+        --fileName;
+    }
+    if (fileName == begin + 1) {
+        // a leading slash needs at least one character in front of it
+        return false;
+    }
+    return end - fileName > 8 && memcmp(fileName, "moc_", 4) == 0;
+}
+
+// the fast path: without "Q_OBJECT" or "Q_GADGET" in the data there is nothing to lex for
+static const char *findMacroCandidate(const char *pos, const char *end)
+{
+    while (end - pos >= 8) {
+        pos = static_cast<const char *>(memchr(pos, 'Q', end - pos - 7));
+        if (!pos) {
+            return 0;
+        }
+        if (pos[1] == '_' && (memcmp(pos + 2, "OBJECT", 6) == 0 || memcmp(pos + 2, "GADGET", 6) == 0)) {
+            return pos;
+        }
+        ++pos;
+    }
+    return 0;
+}
+
+// the same for moc includes, they all contain "moc"
+static bool hasIncludeCandidate(const char *pos, const char *end)
+{
+    while (end - pos >= 3) {
+        pos = static_cast<const char *>(memchr(pos, 'm', end - pos - 2));
+        if (!pos) {
+            return false;
+        }
+        if (pos[1] == 'o' && pos[2] == 'c') {
+            return true;
+        }
+        ++pos;
+    }
+    return false;
+}
+
+namespace
+{
+
+class Lexer
+{
+    public:
+        enum Result { NotFound, Found, NeedMoreData };
+
+        // atEnd: the data is the complete file, otherwise a macro name right at the end of the
+        // data can't be decided yet
+        Lexer(const char *data, int size, bool atEnd)
+            : pos(data), end(data + size), atEnd(atEnd), deadDepth(0)
+        {
+        }
+
+        // with includes == 0 lexing stops at the first macro, otherwise it goes through everything
+        Result run(QStringList *includes);
+
+    private:
+        void skipLineComment();
+        void skipBlockComment();
+        void skipQuoted(char quote);
+        bool skipRawString();
+        void directive(QStringList *includes);
+
+        const char *pos;
+        const char *end;
+        const bool atEnd;
+        int deadDepth;  // > 0 inside a #if 0 block, counts the conditionals nested in it
+};
+
+}
+
+void Lexer::skipLineComment()
+{
+    // up to the newline, which the caller sees; a backslash at the end continues the comment
+    while (pos < end) {
+        if (*pos == '\n' && pos[-1] != '\\' && !(pos[-1] == '\r' && pos[-2] == '\\')) {
+            return;
+        }
+        ++pos;
+    }
+}
+
+void Lexer::skipBlockComment()
+{
+    // pos is behind the "/*"
+    while (end - pos >= 2) {
+        pos = static_cast<const char *>(memchr(pos, '*', end - pos - 1));
+        if (!pos) {
+            break;
+        }
+        if (pos[1] == '/') {
+            pos += 2;
+            return;
+        }
+        ++pos;
+    }
+    pos = end;
+}
+
+void Lexer::skipQuoted(char quote)
+{
+    // pos is on the opening quote, an unterminated literal ends at the end of the line
+    ++pos;
+    while (pos < end) {
+        const char c = *pos;
+        if (c == '\\') {
+            pos += 2;
+        } else if (c == quote) {
+            ++pos;
+            return;
+        } else if (c == '\n') {
+            return;
+        } else {
+            ++pos;
+        }
+    }
+    pos = end;
+}
+
+bool Lexer::skipRawString()
+{
+    // pos is on the quote of R"delimiter( ... )delimiter"
+    const char *delimiter = pos + 1;
+    const char *paren = delimiter;
+    while (paren < end && paren - delimiter <= 16 && *paren != '(') {
+        if (isSpace(*paren) || *paren == ')' || *paren == '\\' || *paren == '"') {
+            return false;
+        }
+        ++paren;
+    }
+    if (paren >= end || *paren != '(') {
+        return false;
+    }
+    const int delimiterLength = paren - delimiter;
+    for (const char *p = paren + 1; end - p >= delimiterLength + 2; ++p) {
+        if (*p == ')' && p[delimiterLength + 1] == '"' &&
+                memcmp(p + 1, delimiter, delimiterLength) == 0) {
+            pos = p + delimiterLength + 2;
+            return true;
+        }
+    }
+    pos = end;
+    return true;
+}
+
+void Lexer::directive(QStringList *includes)
+{
+    // pos is behind the '#'
+    while (pos < end && (*pos == ' ' || *pos == '\t')) {
+        ++pos;
+    }
+    const char *name = pos;
+    while (pos < end && isWordChar(*pos)) {
+        ++pos;
+    }
+    const char *nameEnd = pos;
+    while (pos < end && (*pos == ' ' || *pos == '\t')) {
+        ++pos;
+    }
+
+    if (equals(name, nameEnd, "include")) {
+        if (includes && deadDepth == 0 && pos < end && (*pos == '"' || *pos == '<')) {
+            const char *fileName = ++pos;
+            while (pos < end && *pos != ' ' && *pos != '"' && *pos != '>' && *pos != '\n') {
+                ++pos;
+            }
+            if (pos < end && (*pos == '"' || *pos == '>') && isMocFileName(fileName, pos)) {
+                *includes << QString::fromUtf8(fileName, pos - fileName);
+            }
+        }
+    } else if (equals(name, nameEnd, "if")) {
+        if (deadDepth > 0) {
+            ++deadDepth;
+        } else if (pos < end && *pos == '0' && (pos + 1 == end || !isWordChar(pos[1]))) {
+            deadDepth = 1;
+        }
+    } else if (equals(name, nameEnd, "ifdef") || equals(name, nameEnd, "ifndef")) {
+        if (deadDepth > 0) {
+            ++deadDepth;
+        }
+    } else if (equals(name, nameEnd, "else") || equals(name, nameEnd, "elif")) {
+        if (deadDepth == 1) {
+            // the other branch of a #if 0 may well be used
+            deadDepth = 0;
+        }
+    } else if (equals(name, nameEnd, "endif")) {
+        if (deadDepth > 0) {
+            --deadDepth;
+        }
+    }
+
+    // nothing else in a directive matters, e.g. a Q_OBJECT in a #define is no class declaration
+    while (pos < end) {
+        const char c = *pos;
+        if (c == '\n') {
+            if (pos[-1] != '\\' && !(pos[-1] == '\r' && pos[-2] == '\\')) {
+                return;
+            }
+            ++pos;
+        } else if (c == '/' && pos + 1 < end && pos[1] == '*') {
+            pos += 2;
+            skipBlockComment();
+        } else if (c == '/' && pos + 1 < end && pos[1] == '/') {
+            skipLineComment();
+        } else if ((c == '"' || c == '\'') && deadDepth == 0) {
+            skipQuoted(c);
+        } else {
+            ++pos;
+        }
+    }
+}
+
+Lexer::Result Lexer::run(QStringList *includes)
+{
+    bool lineStart = true;  // only whitespace and comments since the last newline
+    bool found = false;
+    while (pos < end) {
+        const char c = *pos;
+        if (c == '\n') {
+            lineStart = true;
+            ++pos;
+            continue;
+        }
+        if (isSpace(c)) {
+            ++pos;
+            continue;
+        }
+        if (c == '/' && pos + 1 < end && (pos[1] == '/' || pos[1] == '*')) {
+            pos += 2;
+            if (pos[-1] == '/') {
+                skipLineComment();
+            } else {
+                skipBlockComment();
+            }
+            continue;
+        }
+        if (c == '#' && lineStart) {
+            ++pos;
+            directive(includes);
+            continue;
+        }
+        lineStart = false;
+
+        if (deadDepth > 0) {
+            // only comments and directives matter in a #if 0 block, it doesn't even have to
+            // consist of valid tokens
+            ++pos;
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            skipQuoted(c);
+            continue;
+        }
+        if (!isWordChar(c)) {
+            ++pos;
+            continue;
+        }
+
+        const char *word = pos;
+        if (isDigit(c)) {
+            // a number, it may contain ' as digit separator and a . or an exponent sign
+            ++pos;
+            while (pos < end && (isWordChar(*pos) || *pos == '.' ||
+                        (*pos == '\'' && pos + 1 < end && isWordChar(pos[1])) ||
+                        ((*pos == '+' || *pos == '-') && (pos[-1] == 'e' || pos[-1] == 'E' ||
+                            pos[-1] == 'p' || pos[-1] == 'P')))) {
+                ++pos;
+            }
+            continue;
+        }
+        while (pos < end && isWordChar(*pos)) {
+            ++pos;
+        }
+        if (pos < end && *pos == '"' && pos[-1] == 'R' && (pos - word == 1 ||
+                    equals(word, pos, "u8R") || equals(word, pos, "uR") ||
+                    equals(word, pos, "UR") || equals(word, pos, "LR"))) {
+            if (skipRawString()) {
+                continue;
+            }
+        }
+        if (pos - word == 8 && word[0] == 'Q' && word[1] == '_' &&
+                (memcmp(word + 2, "OBJECT", 6) == 0 || memcmp(word + 2, "GADGET", 6) == 0)) {
+            if (pos == end && !atEnd) {
+                // Q_OBJECTS or so in the next chunk
+                return NeedMoreData;
+            }
+            if (!includes) {
+                return Found;
+            }
+            found = true;
+        }
+    }
+    return found ? Found : NotFound;
+}
+
+bool MocScanner::containsQObject(const char *data, int size)
+{
+    if (!findMacroCandidate(data, data + size)) {
+        return false;
+    }
+    return Lexer(data, size, true).run(0) == Lexer::Found;
+}
+
+bool MocScanner::containsQObject(QIODevice *device)
+{
+    // the lexer has to start at the beginning of the file, so it only runs once a chunk brought
+    // a macro name. If that one doesn't count, the rest of the file is read and lexed in one go.
+    static const qint64 chunkSize = 64 * 1024;
+    QByteArray data;
+    forever {
+        const QByteArray chunk = device->read(chunkSize);
+        if (chunk.isEmpty()) {
+            return false;
+        }
+        // a macro name may start in the previous chunk
+        const int searchFrom = qMax(0, data.size() - 7);
+        data += chunk;
+        if (!findMacroCandidate(data.constData() + searchFrom, data.constData() + data.size())) {
+            continue;
+        }
+        if (Lexer(data.constData(), data.size(), false).run(0) == Lexer::Found) {
+            return true;
+        }
+        data += device->readAll();
+        return Lexer(data.constData(), data.size(), true).run(0) == Lexer::Found;
+    }
+}
+
+QStringList MocScanner::mocIncludes(const char *data, int size)
+{
+    QStringList result;
+    if (hasIncludeCandidate(data, data + size)) {
+        Lexer(data, size, true).run(&result);
+    }
+    return result;
+}
+
+bool MocScanner::scanSource(const char *data, int size, QStringList *mocIncludes)
+{
+    const bool macroCandidate = findMacroCandidate(data, data + size);
+    if (!macroCandidate && !hasIncludeCandidate(data, data + size)) {
+        return false;
+    }
+    if (!macroCandidate) {
+        Lexer(data, size, true).run(mocIncludes);
+        return false;
+    }
+    return Lexer(data, size, true).run(mocIncludes) == Lexer::Found;
+}
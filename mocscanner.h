@@ -0,0 +1,54 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MOCSCANNER_H
+#define MOCSCANNER_H
+
+#include <QtCore/QStringList>
+
+class QIODevice;
+
+// Finds moc includes and the Q_OBJECT and Q_GADGET macros in the raw (UTF-8) contents of a file,
+// without decoding it to a QString first. A small lexer skips comments, string and character
+// literals (raw strings included), the bodies of preprocessor directives and #if 0 blocks, so
+// that only what the compiler and moc actually see counts. The macros are found anywhere in a
+// line. Files that contain neither a macro name nor anything like a moc file name are rejected
+// without running the lexer.
+namespace MocScanner
+{
+    // returns true if the data contains a Q_OBJECT or Q_GADGET macro
+    bool containsQObject(const char *data, int size);
+
+    // same as above, but reads the device in chunks and stops at the first macro
+    bool containsQObject(QIODevice *device);
+
+    // returns the file names of all moc includes in the data, in the order they appear
+    QStringList mocIncludes(const char *data, int size);
+
+    // both of the above in one pass
+    bool scanSource(const char *data, int size, QStringList *mocIncludes);
+}
+
+#endif // MOCSCANNER_H
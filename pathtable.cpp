@@ -0,0 +1,90 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "pathtable.h"
+
+void PathTable::clear()
+{
+    dirs.clear();
+    dirIds.clear();
+    entries.clear();
+}
+
+int PathTable::insertDir(const QString &dir)
+{
+    const QHash<QString, int>::ConstIterator it = dirIds.constFind(dir);
+    if (it != dirIds.constEnd()) {
+        return it.value();
+    }
+    Dir newDir;
+    newDir.path = dir;
+    dirs.append(newDir);
+    dirIds.insert(dir, dirs.size() - 1);
+    return dirs.size() - 1;
+}
+
+int PathTable::insert(const QString &path)
+{
+    const int slash = path.lastIndexOf(QLatin1Char('/'));
+    const int dir = insertDir(path.left(slash));
+    const QString fileName = path.mid(slash + 1);
+    const int existing = find(dir, fileName);
+    if (existing >= 0) {
+        return existing;
+    }
+    Entry entry;
+    entry.dir = dir;
+    entry.name = fileName;
+    entries.append(entry);
+    dirs[dir].files.insert(fileName, entries.size() - 1);
+    return entries.size() - 1;
+}
+
+int PathTable::insert(int dir, const QString &fileName)
+{
+    const int existing = find(dir, fileName);
+    if (existing >= 0) {
+        return existing;
+    }
+    // a copy and not a shared string, the caller may reuse the buffer of fileName
+    const QString name(fileName.constData(), fileName.size());
+    Entry entry;
+    entry.dir = dir;
+    entry.name = name;
+    entries.append(entry);
+    dirs[dir].files.insert(name, entries.size() - 1);
+    return entries.size() - 1;
+}
+
+int PathTable::find(int dir, const QString &fileName) const
+{
+    return dirs[dir].files.value(fileName, -1);
+}
+
+QString PathTable::path(int id) const
+{
+    const Entry &entry = entries[id];
+    return dirs[entry.dir].path + QLatin1Char('/') + entry.name;
+}
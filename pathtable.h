@@ -0,0 +1,71 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PATHTABLE_H
+#define PATHTABLE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+// The files the scan of a target looks at, each stored once and referred to by its index. A file
+// is looked up by the index of its directory and its name, so the candidate headers of a source
+// can be tried without building their paths.
+class PathTable
+{
+    public:
+        void clear();
+
+        // a directory path without the trailing slash
+        int insertDir(const QString &dir);
+        // splits the path at the last slash
+        int insert(const QString &path);
+        int insert(int dir, const QString &fileName);
+        // -1 if the file is not in the table
+        int find(int dir, const QString &fileName) const;
+
+        // put together on every call, only the directory and the name are stored
+        QString path(int id) const;
+        int dir(int id) const { return entries[id].dir; }
+        const QString &dirPath(int dir) const { return dirs[dir].path; }
+
+    private:
+        struct Dir
+        {
+            QString path;
+            QHash<QString, int> files;  // key = file name
+        };
+        struct Entry
+        {
+            int dir;
+            QString name;  // shares the data with the key in Dir::files
+        };
+
+        QVector<Dir> dirs;
+        QHash<QString, int> dirIds;  // key = directory path
+        QVector<Entry> entries;
+};
+
+#endif // PATHTABLE_H
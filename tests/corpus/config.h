@@ -0,0 +1,17 @@
+/* This file is part of the automoc4 test corpus. */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define HAVE_UNISTD_H 1
+#define PROJECT_NAME "corpus"
+
+#include <QtCore/QtGlobal>
+
+class Settings
+{
+public:
+    static QString value(const QString &key);
+};
+
+#endif
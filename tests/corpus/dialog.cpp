@@ -0,0 +1,19 @@
+// This file is part of the automoc4 test corpus.
+
+#include "dialog.h"
+#include "ui_dialog.h"
+
+Dialog::Dialog(QWidget *parent)
+    : QDialog(parent)
+{
+    ui.setupUi(this);
+    connect(ui.buttonBox, SIGNAL(accepted()), SLOT(accept()));
+}
+
+void Dialog::accept()
+{
+    emit done(ui.lineEdit->text());
+    QDialog::accept();
+}
+
+#include "moc_dialog.cpp"
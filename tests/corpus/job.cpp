@@ -0,0 +1,27 @@
+/*
+    This file is part of the automoc4 test corpus.
+*/
+
+#include "job.h"
+#include "jobqueue.h"
+
+#include <QtCore/QThread>
+
+class JobThread : public QThread
+{
+    Q_OBJECT
+protected:
+    void run();
+Q_SIGNALS:
+    void progress(int percent);
+};
+
+void JobThread::run()
+{
+    for (int i = 0; i <= 100; i += 10) {
+        emit progress(i);
+    }
+}
+
+#include "job.moc"
+#include "moc_jobqueue.cpp"
@@ -0,0 +1,22 @@
+/*
+    This file is part of the automoc4 test corpus.
+*/
+
+#ifndef MODEL_P_H
+#define MODEL_P_H
+
+#include <QtCore/QAbstractItemModel>
+#include <QtCore/QStringList>
+
+class ModelPrivate : public QObject
+{
+	Q_OBJECT	// for the slots below
+public:
+    QStringList rows;
+
+public Q_SLOTS:
+    void reset();
+    void append(const QString &row);
+};
+
+#endif
@@ -0,0 +1,28 @@
+// This file is part of the automoc4 test corpus.
+
+#include "plugin.h"
+#include "private/plugin_p.h"
+
+#include <QtCore/QtPlugin>
+
+class PluginFactory : public QObject, public FactoryInterface
+{
+	Q_OBJECT
+	Q_INTERFACES(FactoryInterface)
+public:
+	QObject *create(const QString &key);
+};
+
+QObject *PluginFactory::create(const QString &key)
+{
+    if (key == QLatin1String("plugin")) {
+        return new Plugin;
+    }
+    return 0;
+}
+
+Q_EXPORT_PLUGIN2(plugin, PluginFactory)
+
+  #  include <moc_plugin.cpp>
+#include "private/moc_plugin_p.cpp"
+#include	"plugin.moc"
@@ -0,0 +1,18 @@
+/*
+    This file is part of the automoc4 test corpus.
+    Grüße aus Köln, ¡hola!, 日本語
+*/
+
+#include "translator.h"
+
+// Übersetzer mit Signalen
+class Translator : public QObject
+{
+    Q_OBJECT
+public:
+    QString tr(const char *text) { return QString::fromUtf8(text); }
+};
+
+static const char *greeting = "Grüß Gott";
+
+#include "translator.moc"
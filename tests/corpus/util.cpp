@@ -0,0 +1,24 @@
+// This file is part of the automoc4 test corpus. It has no moc include
+// and no class that needs a moc.
+
+#include "util.h"
+#include "mocking.h"
+#include "moc.h"
+#include <moc_defs.h>
+
+enum Limits {
+    Q_OBJECTS_MAX = 16,
+    Q_GADGETS_MAX = 8
+};
+
+static const char *const header = "// Q_OBJECT";
+
+int Util::limit(int count)
+{
+    return count > Q_OBJECTS_MAX ? Q_OBJECTS_MAX : count;
+}
+
+bool Util::isMocFile(const QString &name)
+{
+    return name.endsWith(QLatin1String(".moc")) || name.startsWith(QLatin1String("moc_"));
+}
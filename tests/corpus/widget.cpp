@@ -0,0 +1,34 @@
+/*
+    This file is part of the automoc4 test corpus.
+*/
+
+#include "widget.h"
+
+#include <QtCore/QTimer>
+#include <QtGui/QPaintEvent>
+
+class WidgetPrivate : public QObject
+{
+    Q_OBJECT
+    public:
+        WidgetPrivate(Widget *q) : q(q) {}
+
+    public slots:
+        void update() { q->repaint(); }
+
+    private:
+        Widget *q;
+};
+
+Widget::Widget(QWidget *parent)
+    : QWidget(parent), d(new WidgetPrivate(this))
+{
+    QTimer::singleShot(0, d, SLOT(update()));
+}
+
+Widget::~Widget()
+{
+    delete d;
+}
+
+#include "widget.moc"
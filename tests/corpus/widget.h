@@ -0,0 +1,32 @@
+/*
+    This file is part of the automoc4 test corpus.
+*/
+
+#ifndef WIDGET_H
+#define WIDGET_H
+
+#include <QtGui/QWidget>
+
+class WidgetPrivate;
+
+/**
+ * A widget that repaints itself once the event loop runs. Like every class
+ * with signals or slots it needs
+ * Q_OBJECT
+ * in its declaration, which this comment doesn't count as.
+ */
+class Widget : public QWidget
+{
+    Q_OBJECT
+    Q_PROPERTY(int value READ value)
+    public:
+        explicit Widget(QWidget *parent = 0);
+        ~Widget();
+
+        int value() const { return 42; }
+
+    private:
+        WidgetPrivate *d;
+};
+
+#endif // WIDGET_H
@@ -0,0 +1,11 @@
+// This file is part of the automoc4 test corpus, with DOS line endings.
+
+#include "window.h"
+
+class WindowPrivate : public QObject
+{
+    Q_OBJECT
+};
+
+#include "moc_window.cpp"
+#include "window.moc"
@@ -0,0 +1,94 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Runs MocScanner over the files of the corpus and compares its results with the regular
+// expressions automoc4 used before it. The scanner also skips comments, strings and #if 0
+// blocks and knows Q_GADGET, the expressions did not. The corpus only has what both are meant
+// to agree on: ordinary sources and headers, as most projects have them.
+
+#include "mocscanner.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QRegExp>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <cstdlib>
+
+static QStringList regExpMocIncludes(const QString &contents, bool *hasQObject)
+{
+    // the expressions and the loop of AutoMoc::run in automoc4 0.9.89
+    QRegExp mocIncludeRegExp(QLatin1String("[\n]\\s*#\\s*include\\s+[\"<]((?:[^ \">]+/)?moc_[^ \">/]+\\.cpp|[^ \">]+\\.moc)[\">]"));
+    QRegExp qObjectRegExp(QLatin1String("[\n]\\s*Q_OBJECT\\b"));
+
+    *hasQObject = qObjectRegExp.indexIn(contents) >= 0;
+    QStringList mocIncludes;
+    int matchOffset = mocIncludeRegExp.indexIn(contents);
+    while (matchOffset >= 0) {
+        const QString currentMoc = mocIncludeRegExp.cap(1);
+        mocIncludes << currentMoc;
+        matchOffset = mocIncludeRegExp.indexIn(contents, matchOffset + currentMoc.length());
+    }
+    return mocIncludes;
+}
+
+int main(int argc, char **argv)
+{
+    QTextStream cerr(stderr);
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " <corpus file>..." << endl;
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    for (int i = 1; i < argc; ++i) {
+        QFile file(QFile::decodeName(argv[i]));
+        if (!file.open(QIODevice::ReadOnly)) {
+            cerr << "FAIL: could not read " << file.fileName() << endl;
+            ++failures;
+            continue;
+        }
+        const QByteArray contents = file.readAll();
+
+        bool expectedQObject = false;
+        const QStringList expectedIncludes = regExpMocIncludes(QString::fromUtf8(contents),
+                &expectedQObject);
+        QStringList mocIncludes;
+        const bool qObject = MocScanner::scanSource(contents.constData(), contents.size(),
+                &mocIncludes);
+        if (mocIncludes != expectedIncludes) {
+            cerr << "FAIL: " << file.fileName() << ": moc includes " << mocIncludes.join(" ") <<
+                ", expected " << expectedIncludes.join(" ") << endl;
+            ++failures;
+        }
+        if (qObject != expectedQObject ||
+                MocScanner::containsQObject(contents.constData(), contents.size()) != expectedQObject) {
+            cerr << "FAIL: " << file.fileName() << ": Q_OBJECT " << (qObject ? "found" : "not found") <<
+                ", expected " << (expectedQObject ? "found" : "not found") << endl;
+            ++failures;
+        }
+    }
+    cerr << argc - 1 << " files, " << failures << " failures" << endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
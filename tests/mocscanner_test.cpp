@@ -0,0 +1,194 @@
+/*
+    Copyright (C) 2026 The automoc4 developers
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Cases for the lexer of MocScanner: what counts as a Q_OBJECT or Q_GADGET macro and as a moc
+// include, and what is skipped as a comment, a literal, a directive or a #if 0 block.
+
+#include "mocscanner.h"
+
+#include <QtCore/QBuffer>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <cstdlib>
+
+static int failures = 0;
+
+static void fail(const QString &name, const QString &message)
+{
+    QTextStream cerr(stderr);
+    cerr << "FAIL: " << name << ": " << message << endl;
+    ++failures;
+}
+
+static void checkQObject(const QString &name, const QByteArray &data, bool expected)
+{
+    // the result has to be the same for mapped files and files read in chunks
+    if (MocScanner::containsQObject(data.constData(), data.size()) != expected) {
+        fail(name, expected ? "no macro found" : "macro found");
+    }
+    QByteArray copy = data;
+    QBuffer buffer(&copy);
+    buffer.open(QIODevice::ReadOnly);
+    if (MocScanner::containsQObject(&buffer) != expected) {
+        fail(name, expected ? "no macro found in chunks" : "macro found in chunks");
+    }
+}
+
+static void checkMocIncludes(const QString &name, const QByteArray &data, const QString &expected)
+{
+    const QString mocIncludes = MocScanner::mocIncludes(data.constData(), data.size()).join(" ");
+    if (mocIncludes != expected) {
+        fail(name, "moc includes \"" + mocIncludes + "\", expected \"" + expected + '"');
+    }
+    QStringList scanned;
+    MocScanner::scanSource(data.constData(), data.size(), &scanned);
+    if (scanned.join(" ") != expected) {
+        fail(name, "scanSource found \"" + scanned.join(" ") + "\", expected \"" + expected + '"');
+    }
+}
+
+static void testMacros()
+{
+    checkQObject("class", "class A : public QObject\n{\n    Q_OBJECT\n};\n", true);
+    checkQObject("gadget", "struct A\n{\n    Q_GADGET\n};\n", true);
+    checkQObject("same line", "class A : public QObject { Q_OBJECT };", true);
+    checkQObject("first line", "Q_OBJECT", true);
+    checkQObject("longer name", "Q_OBJECTS x;\nint Q_GADGETS;\n", false);
+    checkQObject("prefix", "MY_Q_OBJECT\nxQ_OBJECT\n", false);
+    checkQObject("lower case", "q_object\n", false);
+}
+
+static void testComments()
+{
+    checkQObject("line comment", "// Q_OBJECT\nint x;\n", false);
+    checkQObject("block comment", "/* class A {\n    Q_OBJECT\n}; */\n", false);
+    checkQObject("after block comment", "/* Q_OBJECT */ Q_GADGET\n", true);
+    checkQObject("line comment continued", "// a \\\n    Q_OBJECT\n", false);
+    checkQObject("line comment continued with crlf", "// a \\\r\n    Q_OBJECT\r\n", false);
+    checkQObject("line comment not continued", "// a \\ b\nQ_OBJECT\n", true);
+    checkQObject("unterminated block comment", "/* Q_OBJECT", false);
+    checkMocIncludes("line comment", "// #include \"foo.moc\"\n", "");
+    checkMocIncludes("block comment", "/*\n#include \"foo.moc\"\n*/\n", "");
+    checkMocIncludes("comment before directive", "/* x */ #include \"foo.moc\"\n", "foo.moc");
+    checkMocIncludes("line comment continued", "// a \\\n#include \"foo.moc\"\n", "");
+}
+
+static void testLiterals()
+{
+    checkQObject("string", "const char *s = \"Q_OBJECT\";\n", false);
+    checkQObject("escaped quote", "const char *s = \"\\\" Q_OBJECT\";\n", false);
+    checkQObject("char", "char c = '\"'; Q_OBJECT\n", true);
+    checkQObject("unterminated string", "const char *s = \"a\nQ_OBJECT\n", true);
+    checkQObject("raw string", "const char *s = R\"(Q_OBJECT)\";\n", false);
+    checkQObject("raw string delimiter", "const char *s = R\"x(\")\" Q_OBJECT )x\";\n", false);
+    checkQObject("raw string after", "const char *s = R\"x(a)x\"; Q_OBJECT\n", true);
+    checkQObject("raw string prefixes", "u8R\"(Q_OBJECT)\" uR\"(Q_OBJECT)\" UR\"(Q_OBJECT)\" "
+            "LR\"(Q_OBJECT)\"\n", false);
+    checkQObject("raw string lines", "R\"(\n#include \"foo.moc\"\nQ_OBJECT\n)\"\n", false);
+    checkQObject("no raw string", "FOOR\"(\" Q_OBJECT\n", true);
+    checkMocIncludes("raw string", "R\"(\n#include \"foo.moc\"\n)\";\n", "");
+    checkMocIncludes("string", "\"\n#include \"foo.moc\"\n", "foo.moc");
+}
+
+static void testDigitSeparators()
+{
+    checkQObject("digit separator", "int x = 1'000'000; Q_OBJECT\n", true);
+    checkQObject("hex digit separator", "int x = 0xff'ff; Q_OBJECT\n", true);
+    checkQObject("char after number", "int x = 1; char c = 'Q'; Q_OBJECT\n", true);
+    checkQObject("exponent", "double d = 1e-5'0; Q_OBJECT\n", true);
+    checkQObject("separator before string", "int x = 1'0; const char *s = \"Q_OBJECT\";\n", false);
+}
+
+static void testDirectives()
+{
+    checkQObject("define", "#define X Q_OBJECT\n", false);
+    checkQObject("define continued", "#define X \\\n    Q_OBJECT\n", false);
+    checkQObject("define continued with crlf", "#define X \\\r\n    Q_OBJECT\r\n", false);
+    checkQObject("after define", "#define X \\\n    a\nQ_OBJECT\n", true);
+    checkQObject("comment in define", "#define X /* \n */ Q_OBJECT\n", false);
+    checkQObject("line comment continued in define", "#define X // \\\n Q_OBJECT\n", false);
+    checkQObject("not at line start", "int x; # Q_OBJECT\n", true);
+    checkMocIncludes("moc_ style", "#include <moc_foo.cpp>\n", "moc_foo.cpp");
+    checkMocIncludes("spaces", "  #  include   \"foo.moc\"\n", "foo.moc");
+    checkMocIncludes("tab", "#include\t\"foo.moc\"\n", "foo.moc");
+    checkMocIncludes("subdir", "#include \"sub/moc_foo.cpp\"\n#include \"sub/foo.moc\"\n",
+            "sub/moc_foo.cpp sub/foo.moc");
+    checkMocIncludes("order", "#include \"b.moc\"\n#include \"moc_a.cpp\"\n", "b.moc moc_a.cpp");
+    checkMocIncludes("not a moc", "#include \"moc.h\"\n#include \"moc_a.h\"\n#include \".moc\"\n"
+            "#include \"/moc_a.cpp\"\n#include \"moc_a/b.cpp\"\n", "");
+    checkMocIncludes("not a directive", "x #include \"foo.moc\"\n", "");
+    checkMocIncludes("crlf", "#include \"foo.moc\"\r\n", "foo.moc");
+}
+
+static void testConditionals()
+{
+    checkQObject("if 0", "#if 0\nQ_OBJECT\n#endif\n", false);
+    checkQObject("after if 0", "#if 0\n#endif\nQ_OBJECT\n", true);
+    checkQObject("if 0 else", "#if 0\nQ_OBJECT\n#else\nQ_OBJECT\n#endif\n", true);
+    checkQObject("if 0 elif", "#if 0\n#elif defined(X)\nQ_OBJECT\n#endif\n", true);
+    checkQObject("if 0 nested", "#if 0\n#ifdef X\n#else\nQ_OBJECT\n#endif\nQ_OBJECT\n#endif\n", false);
+    checkQObject("if 0 nested if", "#if 0\n#if 1\n#endif\nQ_OBJECT\n#endif\n", false);
+    checkQObject("if 0 nested ifndef", "#if 0\n#ifndef X\n#endif\n#endif\nQ_OBJECT\n", true);
+    checkQObject("if 0 in comment", "/*\n#if 0\n*/\nQ_OBJECT\n", true);
+    checkQObject("if 0 literals", "#if 0\nit's \"not code\nQ_OBJECT\n#endif\n", false);
+    checkQObject("if 00", "#if 00\nQ_OBJECT\n#endif\n", true);
+    checkQObject("if 0x", "#if 0x1\nQ_OBJECT\n#endif\n", true);
+    checkQObject("if 1", "#if 1\nQ_OBJECT\n#endif\n", true);
+    checkMocIncludes("if 0", "#if 0\n#include \"foo.moc\"\n#endif\n", "");
+    checkMocIncludes("if 0 else", "#if 0\n#include \"a.moc\"\n#else\n#include \"b.moc\"\n#endif\n",
+            "b.moc");
+}
+
+static void testChunks()
+{
+    // containsQObject(QIODevice *) reads 64 KiB at a time
+    const int chunkSize = 64 * 1024;
+    const QByteArray padding(chunkSize - 4, ' ');
+    const QByteArray fullPadding(chunkSize - 8, ' ');
+    checkQObject("macro across chunks", padding + "Q_OBJECT\n", true);
+    checkQObject("macro at the end of a chunk", fullPadding + "Q_OBJECT", true);
+    checkQObject("macro at the end of a chunk with more", fullPadding + "Q_OBJECT\n", true);
+    checkQObject("longer name across chunks", fullPadding + "Q_OBJECTS\n", false);
+    checkQObject("comment across chunks", "/*" + padding + "*/ Q_OBJECT\n", true);
+    checkQObject("macro in comment across chunks", "/*" + padding + "Q_OBJECT */\n", false);
+    checkQObject("string across chunks", "\"" + padding + "Q_OBJECT\";\n", false);
+    checkQObject("raw string across chunks", "R\"(" + padding + "Q_OBJECT)\";\n", false);
+    checkQObject("if 0 across chunks", "#if 0\n" + padding + "Q_OBJECT\n#endif\n", false);
+    checkQObject("macro after a dead one", "// Q_OBJECT\n" + padding + padding + "Q_GADGET\n", true);
+}
+
+int main()
+{
+    testMacros();
+    testComments();
+    testLiterals();
+    testDigitSeparators();
+    testDirectives();
+    testConditionals();
+    testChunks();
+    QTextStream cerr(stderr);
+    cerr << failures << " failures" << endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}